@@ -0,0 +1,180 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Records per second through ihex_process_data()
+ *
+ * Feeds an in memory upload to the IHEX handler in spans of different
+ * sizes. With 1 byte spans no record is ever complete, so every byte goes
+ * through the kk_ihex state machine the way all of them used to. With
+ * the 512 byte spans the uploader uses, almost every record takes the
+ * whole line fast path.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nanokernel.h>
+#include <fs.h>
+
+#include "uart-uploader.h"
+#include "ihex/kk_ihex_read.h"
+
+#include "sim.h"
+
+#define RECORD_SIZE 16
+
+/* Not exported by ihex-handler.h, the uploader reaches them through
+ * process_set_config()
+ */
+extern uint32_t ihex_process_init();
+extern uint32_t ihex_process_data(const struct uploader_span *span);
+extern uint32_t ihex_process_finish();
+extern void __stdout_hook_install(int (*hook)(int));
+
+static char *hex;
+static size_t hex_len;
+
+/* stdout belongs to the device once sim_stdout_init() has run */
+static FILE *report;
+
+/* What the handler prints to the ACM port is of no interest here */
+static int discard(int c) {
+	return c;
+}
+
+static void add_record(uint8_t type, uint16_t address, const uint8_t *data,
+		       uint8_t len) {
+	uint8_t sum = len + (address >> 8) + (address & 0xFF) + type;
+	int i;
+
+	hex_len += sprintf(hex + hex_len, ":%02X%04X%02X", len, address, type);
+	for (i = 0; i < len; i++) {
+		hex_len += sprintf(hex + hex_len, "%02X", data[i]);
+		sum += data[i];
+	}
+	hex_len += sprintf(hex + hex_len, "%02X\r\n", (uint8_t)-sum);
+}
+
+static uint8_t *build_upload(uint32_t records) {
+	uint8_t *image = malloc(records * RECORD_SIZE);
+	uint32_t address;
+	uint8_t upper[2];
+
+	hex = malloc((size_t)records * (RECORD_SIZE * 2 + 16) + 1024);
+	for (address = 0; address < records * RECORD_SIZE; address++)
+		image[address] = (uint8_t)(address * 7 + (address >> 8));
+
+	for (address = 0; address < records * RECORD_SIZE; address += RECORD_SIZE) {
+		if ((address & 0xFFFF) == 0 && address > 0) {
+			upper[0] = address >> 24;
+			upper[1] = address >> 16;
+			add_record(IHEX_EXTENDED_LINEAR_ADDRESS_RECORD, 0, upper, 2);
+		}
+		add_record(IHEX_DATA_RECORD, address & 0xFFFF, image + address,
+			   RECORD_SIZE);
+	}
+	add_record(IHEX_END_OF_FILE_RECORD, 0, NULL, 0);
+	return image;
+}
+
+static bool check_upload(const uint8_t *image, uint32_t size) {
+	uint8_t *data = malloc(size);
+	bool same;
+	ZFILE fp;
+
+	if (fs_open(&fp, "test.js"))
+		return false;
+
+	same = fs_read(&fp, data, size) == (ssize_t)size &&
+		memcmp(data, image, size) == 0;
+	fs_close(&fp);
+	free(data);
+	return same;
+}
+
+static void run(uint32_t span_size, uint32_t records, const uint8_t *image) {
+	struct uploader_span span;
+	uint64_t start, elapsed;
+	size_t pos = 0;
+	uint32_t processed;
+
+	ihex_process_init();
+
+	start = sim_now_us();
+	while (pos < hex_len) {
+		span.buf = hex + pos;
+		span.len = hex_len - pos;
+		if (span.len > span_size)
+			span.len = span_size;
+		span.token = 0;
+
+		processed = ihex_process_data(&span);
+		if (processed == 0)
+			break;
+		pos += processed;
+	}
+	elapsed = sim_now_us() - start;
+
+	ihex_process_finish();
+	if (elapsed == 0)
+		elapsed = 1;
+
+	fprintf(report, "Span %4u: %6u records in %6llu us, %8llu records/s%s\n",
+		span_size, records, (unsigned long long)elapsed,
+		(unsigned long long)records * 1000000 / elapsed,
+		check_upload(image, records * RECORD_SIZE) ? "" : " MISMATCH");
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t spans[] = { 1, 16, 64, 512 };
+	struct sim_cdc_config config = {
+		.burst = SIM_USB_MPS,
+	};
+	char fs_root[] = "/tmp/ihex-bench-XXXXXX";
+	uint32_t records = 20000;
+	uint8_t *image;
+	unsigned int i;
+
+	if (argc > 1)
+		records = strtoul(argv[1], NULL, 0);
+
+	if (mkdtemp(fs_root) == NULL) {
+		perror(fs_root);
+		return 1;
+	}
+
+	report = fdopen(dup(STDOUT_FILENO), "w");
+	setvbuf(report, NULL, _IOLBF, 0);
+	sim_stdout_init();
+	__stdout_hook_install(discard);
+	sim_fs_init(fs_root);
+	sim_cdc_start(&config, -1);
+	image = build_upload(records);
+
+	for (i = 0; i < ARRAY_SIZE(spans); i++)
+		run(spans[i], records, image);
+
+	unlink(strcat(fs_root, "/test.js"));
+	return 0;
+}
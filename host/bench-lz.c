@@ -0,0 +1,139 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Inflate speed of lz-stream.c and what it makes of a link
+ *
+ * Compresses a file (scripts/sample.js unless given) with the host tool,
+ * inflates it with the device code in spans of different sizes and prints
+ * the effective upload rate for some link rates: the link carries
+ * compressed bytes, so the file arrives ratio times faster unless the
+ * inflating cannot keep up.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nanokernel.h>
+
+#include "lz-stream.h"
+#include "lz-compress.h"
+
+#include "sim.h"
+
+#define ROUNDS 50
+
+static uint8_t *output;
+static size_t output_len;
+
+static bool copy_sink(const char *buf, uint32_t len) {
+	memcpy(output + output_len, buf, len);
+	output_len += len;
+	return true;
+}
+
+static uint8_t *read_all(const char *path, size_t *len) {
+	FILE *file = fopen(path, "rb");
+	uint8_t *data;
+	long size;
+
+	if (file == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data = malloc(size + 1);
+	if (fread(data, 1, size, file) != (size_t)size) {
+		perror(path);
+		exit(1);
+	}
+	fclose(file);
+
+	*len = size;
+	return data;
+}
+
+/* Output bytes per second inflating packed in spans of span_size */
+static uint64_t run(const uint8_t *packed, size_t packed_len, uint32_t span_size,
+		    const uint8_t *data, size_t len) {
+	static struct lz_stream lz;
+	uint64_t start, elapsed;
+	size_t pos, piece;
+	bool ok = true;
+	int round;
+
+	start = sim_now_us();
+	for (round = 0; round < ROUNDS; round++) {
+		output_len = 0;
+		lz_stream_init(&lz, copy_sink);
+		for (pos = 0; pos < packed_len && ok; pos += piece) {
+			piece = packed_len - pos;
+			if (piece > span_size)
+				piece = span_size;
+			ok = lz_stream_feed(&lz, packed + pos, piece);
+		}
+		ok = ok && lz_stream_finish(&lz);
+	}
+	elapsed = sim_now_us() - start;
+	if (elapsed == 0)
+		elapsed = 1;
+
+	ok = ok && output_len == len && memcmp(output, data, len) == 0;
+	printf("Span %4u: %8llu bytes/s%s\n", span_size,
+		(unsigned long long)len * ROUNDS * 1000000 / elapsed,
+		ok ? "" : " MISMATCH");
+	return (uint64_t)len * ROUNDS * 1000000 / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t spans[] = { 16, 64, 512 };
+	static const uint32_t links[] = { 20000, 64000, 1000000 };
+	const char *path = argc > 1 ? argv[1] : "scripts/sample.js";
+	uint64_t inflate = 0, rate, effective;
+	uint8_t *data, *packed;
+	size_t len, packed_len;
+	unsigned int i;
+	double ratio;
+
+	data = read_all(path, &len);
+	packed = malloc(LZ_COMPRESS_BOUND(len));
+	output = malloc(len);
+	packed_len = lz_compress(data, len, packed);
+	ratio = (double)len / packed_len;
+
+	printf("%s: %zu -> %zu bytes, ratio %.2f, %u bytes of RAM to inflate\n",
+		path, len, packed_len, ratio, (unsigned int)sizeof(struct lz_stream));
+
+	for (i = 0; i < ARRAY_SIZE(spans); i++)
+		inflate = run(packed, packed_len, spans[i], data, len);
+
+	/* Inflating runs while the next chunk is received */
+	for (i = 0; i < ARRAY_SIZE(links); i++) {
+		rate = (uint64_t)(links[i] * ratio);
+		effective = rate < inflate ? rate : inflate;
+		printf("Link %7u bytes/s: effective %8llu bytes/s\n", links[i],
+			(unsigned long long)effective);
+	}
+	return 0;
+}
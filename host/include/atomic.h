@@ -0,0 +1,97 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Host atomics on top of the GCC __atomic builtins
+ */
+
+#ifndef __HOST_ATOMIC_H__
+#define __HOST_ATOMIC_H__
+
+#include <stdint.h>
+
+typedef int atomic_t;
+typedef atomic_t atomic_val_t;
+
+static inline atomic_val_t atomic_get(const atomic_t *target)
+{
+	return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_set(atomic_t *target, atomic_val_t value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_clear(atomic_t *target)
+{
+	return atomic_set(target, 0);
+}
+
+static inline atomic_val_t atomic_add(atomic_t *target, atomic_val_t value)
+{
+	return __atomic_fetch_add(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_sub(atomic_t *target, atomic_val_t value)
+{
+	return __atomic_fetch_sub(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_inc(atomic_t *target)
+{
+	return atomic_add(target, 1);
+}
+
+static inline atomic_val_t atomic_dec(atomic_t *target)
+{
+	return atomic_sub(target, 1);
+}
+
+static inline int atomic_cas(atomic_t *target, atomic_val_t old_value,
+			     atomic_val_t new_value)
+{
+	return __atomic_compare_exchange_n(target, &old_value, new_value, 0,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_test_bit(const atomic_t *target, int bit)
+{
+	return (atomic_get(target) >> bit) & 1;
+}
+
+static inline int atomic_test_and_set_bit(atomic_t *target, int bit)
+{
+	return (__atomic_fetch_or(target, 1 << bit, __ATOMIC_SEQ_CST) >> bit) & 1;
+}
+
+static inline int atomic_test_and_clear_bit(atomic_t *target, int bit)
+{
+	return (__atomic_fetch_and(target, ~(1 << bit), __ATOMIC_SEQ_CST) >> bit) & 1;
+}
+
+static inline void atomic_set_bit(atomic_t *target, int bit)
+{
+	__atomic_fetch_or(target, 1 << bit, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_clear_bit(atomic_t *target, int bit)
+{
+	__atomic_fetch_and(target, ~(1 << bit), __ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Host flash API, the raw partition is an array that stands in for
+ * the memory mapped flash
+ */
+
+#ifndef __HOST_FLASH_H__
+#define __HOST_FLASH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <device.h>
+
+/* Offsets are addresses, like the QMSI driver takes them */
+extern uint8_t sim_flash[];
+
+int flash_read(struct device *dev, off_t offset, void *data, size_t len);
+int flash_write(struct device *dev, off_t offset, const void *data, size_t len);
+int flash_erase(struct device *dev, off_t offset, size_t size);
+int flash_write_protection_set(struct device *dev, bool enable);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Host file system API, files live in a directory of the host
+ */
+
+#ifndef __HOST_FS_H__
+#define __HOST_FS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define MAX_FILE_NAME 12
+
+typedef struct {
+	int fd;
+} ZFILE;
+
+typedef struct {
+	void *dir;
+} ZDIR;
+
+enum dir_entry_type {
+	DIR_ENTRY_FILE,
+	DIR_ENTRY_DIR
+};
+
+struct zfs_dirent {
+	enum dir_entry_type type;
+	char name[MAX_FILE_NAME + 1];
+	size_t size;
+};
+
+struct zfs_statvfs {
+	size_t f_bsize;
+	size_t f_frsize;
+	size_t f_blocks;
+	size_t f_bfree;
+};
+
+int fs_open(ZFILE *zfp, const char *file_name);
+int fs_close(ZFILE *zfp);
+int fs_unlink(const char *path);
+ssize_t fs_read(ZFILE *zfp, void *ptr, size_t size);
+ssize_t fs_write(ZFILE *zfp, const void *ptr, size_t size);
+int fs_seek(ZFILE *zfp, off_t offset, int whence);
+off_t fs_tell(ZFILE *zfp);
+int fs_truncate(ZFILE *zfp, off_t length);
+int fs_mkdir(const char *path);
+int fs_opendir(ZDIR *zdp, const char *path);
+int fs_readdir(ZDIR *zdp, struct zfs_dirent *entry);
+int fs_closedir(ZDIR *zdp);
+int fs_stat(const char *path, struct zfs_dirent *entry);
+int fs_statvfs(struct zfs_statvfs *stat);
+
+#endif
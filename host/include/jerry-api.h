@@ -0,0 +1,44 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Stand-in for the JerryScript API, the simulator only counts code
+ */
+
+#ifndef __HOST_JERRY_API_H__
+#define __HOST_JERRY_API_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JERRY_INIT_EMPTY 0
+
+typedef uint32_t jerry_value_t;
+typedef uint8_t jerry_char_t;
+
+void jerry_init(int flags);
+void jerry_cleanup(void);
+jerry_value_t jerry_eval(const jerry_char_t *source_p, size_t source_size,
+			 bool is_strict);
+jerry_value_t jerry_parse(const jerry_char_t *source_p, size_t source_size,
+			  bool is_strict);
+jerry_value_t jerry_run(const jerry_value_t func_val);
+bool jerry_value_has_error_flag(const jerry_value_t value);
+void jerry_release_value(jerry_value_t value);
+
+#endif
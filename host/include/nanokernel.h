@@ -0,0 +1,88 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Host stand-in for the subset of the nanokernel the uploader uses
+ *
+ * Tasks, fibers and the ISR are POSIX threads. irq_lock() takes one
+ * recursive mutex that the simulated interrupt also holds while it runs,
+ * which gives the same exclusion the real lock gives on a single core.
+ */
+
+#ifndef __HOST_NANOKERNEL_H__
+#define __HOST_NANOKERNEL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TICKS_NONE 0
+#define TICKS_UNLIMITED (-1)
+
+#define ARG_UNUSED(x) (void)(x)
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+struct nano_sem {
+	int count;
+};
+
+struct nano_fifo {
+	void *head;
+	void *tail;
+};
+
+/* Semaphores, timeouts are in ticks */
+void nano_sem_init(struct nano_sem *sem);
+void nano_sem_give(struct nano_sem *sem);
+void nano_isr_sem_give(struct nano_sem *sem);
+void nano_task_sem_give(struct nano_sem *sem);
+void nano_fiber_sem_give(struct nano_sem *sem);
+int nano_sem_take(struct nano_sem *sem, int32_t timeout);
+int nano_task_sem_take(struct nano_sem *sem, int32_t timeout);
+int nano_fiber_sem_take(struct nano_sem *sem, int32_t timeout);
+
+/* FIFOs, the first word of every item is reserved for the link */
+void nano_fifo_init(struct nano_fifo *fifo);
+void nano_fifo_put(struct nano_fifo *fifo, void *data);
+void nano_isr_fifo_put(struct nano_fifo *fifo, void *data);
+void nano_task_fifo_put(struct nano_fifo *fifo, void *data);
+void *nano_fifo_get(struct nano_fifo *fifo, int32_t timeout);
+void *nano_isr_fifo_get(struct nano_fifo *fifo, int32_t timeout);
+void *nano_task_fifo_get(struct nano_fifo *fifo, int32_t timeout);
+
+/* Clocks, ticks and cycles run from CLOCK_MONOTONIC */
+extern int sys_clock_ticks_per_sec;
+extern int sys_clock_hw_cycles_per_sec;
+
+uint32_t sys_cycle_get_32(void);
+uint32_t sys_tick_get_32(void);
+int64_t sys_tick_get(void);
+void sys_thread_busy_wait(uint32_t usec_to_wait);
+void task_sleep(int32_t timeout_in_ticks);
+void task_yield(void);
+void fiber_yield(void);
+
+unsigned int irq_lock(void);
+void irq_unlock(unsigned int key);
+
+uint32_t sys_kernel_version_get(void);
+#define SYS_KERNEL_VER_MAJOR(ver) (((ver) >> 24) & 0xFF)
+#define SYS_KERNEL_VER_MINOR(ver) (((ver) >> 16) & 0xFF)
+#define SYS_KERNEL_VER_PATCHLEVEL(ver) (((ver) >> 8) & 0xFF)
+
+#endif
@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Host UART API, backed by the simulated CDC ACM device
+ */
+
+#ifndef __HOST_UART_H__
+#define __HOST_UART_H__
+
+#include <stdint.h>
+#include <device.h>
+
+#define LINE_CTRL_BAUD_RATE (1 << 0)
+#define LINE_CTRL_RTS (1 << 1)
+#define LINE_CTRL_DTR (1 << 2)
+#define LINE_CTRL_DCD (1 << 3)
+#define LINE_CTRL_DSR (1 << 4)
+
+typedef void (*uart_irq_callback_t)(struct device *port);
+
+int uart_fifo_fill(struct device *dev, const uint8_t *tx_data, int size);
+int uart_fifo_read(struct device *dev, uint8_t *rx_data, const int size);
+void uart_irq_tx_enable(struct device *dev);
+void uart_irq_tx_disable(struct device *dev);
+int uart_irq_tx_ready(struct device *dev);
+void uart_irq_rx_enable(struct device *dev);
+void uart_irq_rx_disable(struct device *dev);
+int uart_irq_rx_ready(struct device *dev);
+int uart_irq_is_pending(struct device *dev);
+int uart_irq_update(struct device *dev);
+void uart_irq_callback_set(struct device *dev, uart_irq_callback_t cb);
+int uart_line_ctrl_set(struct device *dev, uint32_t ctrl, uint32_t val);
+int uart_line_ctrl_get(struct device *dev, uint32_t ctrl, uint32_t *val);
+
+#endif
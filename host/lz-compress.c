@@ -0,0 +1,110 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Host side compressor for LZ uploads
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz-stream.h"
+#include "lz-compress.h"
+
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+
+/* Candidates tried for every position */
+#define MAX_CHAIN 64
+
+#define NO_POS UINT32_MAX
+
+static uint32_t hash3(const uint8_t *p) {
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+size_t lz_compress(const uint8_t *in, size_t len, uint8_t *out) {
+	uint32_t *head = malloc(HASH_SIZE * sizeof(*head));
+	uint32_t *prev = malloc(LZ_WINDOW_SIZE * sizeof(*prev));
+	uint8_t *flags = NULL;
+	size_t pos = 0, o = 0;
+	uint32_t cand, best_len, best_dist, l, chain, h;
+	int items = 8;
+
+	memset(head, 0xFF, HASH_SIZE * sizeof(*head));
+
+	out[o++] = 'L';
+	out[o++] = 'Z';
+	out[o++] = LZ_WINDOW_BITS;
+	out[o++] = 0;
+	out[o++] = len;
+	out[o++] = len >> 8;
+	out[o++] = len >> 16;
+	out[o++] = len >> 24;
+
+	while (pos < len) {
+		if (items == 8) {
+			flags = &out[o++];
+			*flags = 0;
+			items = 0;
+		}
+
+		best_len = 0;
+		best_dist = 0;
+		if (pos + LZ_MIN_MATCH <= len) {
+			h = hash3(in + pos);
+			cand = head[h];
+			for (chain = 0; cand != NO_POS && pos - cand <= LZ_WINDOW_SIZE &&
+				chain < MAX_CHAIN; chain++) {
+				for (l = 0; l < LZ_MAX_MATCH && pos + l < len &&
+					in[cand + l] == in[pos + l]; l++)
+					;
+				if (l > best_len) {
+					best_len = l;
+					best_dist = pos - cand;
+					if (l == LZ_MAX_MATCH)
+						break;
+				}
+				cand = prev[cand % LZ_WINDOW_SIZE];
+			}
+		}
+
+		if (best_len < LZ_MIN_MATCH) {
+			*flags |= 1 << items;
+			out[o++] = in[pos];
+			best_len = 1;
+		} else {
+			out[o++] = (best_dist - 1) & 0xFF;
+			out[o++] = ((best_dist - 1) >> 8) << 5 | (best_len - LZ_MIN_MATCH);
+		}
+		items++;
+
+		/* Every position the token covers goes into the chains */
+		for (l = 0; l < best_len; l++, pos++) {
+			if (pos + LZ_MIN_MATCH > len)
+				continue;
+			h = hash3(in + pos);
+			prev[pos % LZ_WINDOW_SIZE] = head[h];
+			head[h] = pos;
+		}
+	}
+
+	free(head);
+	free(prev);
+	return o;
+}
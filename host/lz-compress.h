@@ -0,0 +1,34 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __LZ_COMPRESS_H__
+#define __LZ_COMPRESS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Room the compressed data can take in the worst case */
+#define LZ_COMPRESS_BOUND(len) (8 + (len) + (len) / 8 + 1)
+
+/*
+ * @brief Compresses data into the format lz-stream.c inflates
+ *
+ * Greedy matching over hash chains, the reference for the device side.
+ * @return Bytes written to out
+ */
+size_t lz_compress(const uint8_t *in, size_t len, uint8_t *out);
+
+#endif
@@ -0,0 +1,101 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Compresses files for LZ uploads
+ *
+ *   lz-pack <in> <out>     Compress
+ *   lz-pack -d <in> <out>  Inflate with the device code, to check a file
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz-stream.h"
+#include "lz-compress.h"
+
+static FILE *out_file;
+
+static uint8_t *read_all(const char *path, size_t *len) {
+	FILE *file = fopen(path, "rb");
+	uint8_t *data;
+	long size;
+
+	if (file == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data = malloc(size + 1);
+	if (fread(data, 1, size, file) != (size_t)size) {
+		perror(path);
+		exit(1);
+	}
+	fclose(file);
+
+	*len = size;
+	return data;
+}
+
+static bool file_sink(const char *buf, uint32_t len) {
+	return fwrite(buf, 1, len, out_file) == len;
+}
+
+int main(int argc, char *argv[]) {
+	bool inflate = argc == 4 && !strcmp(argv[1], "-d");
+	struct lz_stream *lz;
+	uint8_t *in, *packed;
+	size_t in_len, out_len;
+
+	if (argc != 3 && !inflate) {
+		fprintf(stderr, "Usage: %s [-d] <in> <out>\n", argv[0]);
+		return 1;
+	}
+
+	in = read_all(argv[argc - 2], &in_len);
+	out_file = fopen(argv[argc - 1], "wb");
+	if (out_file == NULL) {
+		perror(argv[argc - 1]);
+		return 1;
+	}
+
+	if (inflate) {
+		lz = malloc(sizeof(*lz));
+		lz_stream_init(lz, file_sink);
+		if (!lz_stream_feed(lz, in, in_len) || !lz_stream_finish(lz)) {
+			fprintf(stderr, "%s: corrupt\n", argv[2]);
+			return 1;
+		}
+		out_len = lz->produced;
+	} else {
+		packed = malloc(LZ_COMPRESS_BOUND(in_len));
+		out_len = lz_compress(in, in_len, packed);
+		fwrite(packed, 1, out_len, out_file);
+	}
+
+	fclose(out_file);
+	printf("%s: %zu -> %zu bytes, ratio %.2f\n", argv[argc - 2], in_len,
+		out_len, inflate ? (double)out_len / in_len : (double)in_len / out_len);
+	return 0;
+}
@@ -0,0 +1,531 @@
+/* Sample program used by the upload benchmarks */
+
+var counter0 = 0;
+function step0(value) {
+	counter0 += value;
+	return counter0 * 2;
+}
+
+var counter1 = 0;
+function step1(value) {
+	counter1 += value;
+	return counter1 * 2;
+}
+
+var counter2 = 0;
+function step2(value) {
+	counter2 += value;
+	return counter2 * 2;
+}
+
+var counter3 = 0;
+function step3(value) {
+	counter3 += value;
+	return counter3 * 2;
+}
+
+var counter4 = 0;
+function step4(value) {
+	counter4 += value;
+	return counter4 * 2;
+}
+
+var counter5 = 0;
+function step5(value) {
+	counter5 += value;
+	return counter5 * 2;
+}
+
+var counter6 = 0;
+function step6(value) {
+	counter6 += value;
+	return counter6 * 2;
+}
+
+var counter7 = 0;
+function step7(value) {
+	counter7 += value;
+	return counter7 * 2;
+}
+
+var counter8 = 0;
+function step8(value) {
+	counter8 += value;
+	return counter8 * 2;
+}
+
+var counter9 = 0;
+function step9(value) {
+	counter9 += value;
+	return counter9 * 2;
+}
+
+var counter10 = 0;
+function step10(value) {
+	counter10 += value;
+	return counter10 * 2;
+}
+
+var counter11 = 0;
+function step11(value) {
+	counter11 += value;
+	return counter11 * 2;
+}
+
+var counter12 = 0;
+function step12(value) {
+	counter12 += value;
+	return counter12 * 2;
+}
+
+var counter13 = 0;
+function step13(value) {
+	counter13 += value;
+	return counter13 * 2;
+}
+
+var counter14 = 0;
+function step14(value) {
+	counter14 += value;
+	return counter14 * 2;
+}
+
+var counter15 = 0;
+function step15(value) {
+	counter15 += value;
+	return counter15 * 2;
+}
+
+var counter16 = 0;
+function step16(value) {
+	counter16 += value;
+	return counter16 * 2;
+}
+
+var counter17 = 0;
+function step17(value) {
+	counter17 += value;
+	return counter17 * 2;
+}
+
+var counter18 = 0;
+function step18(value) {
+	counter18 += value;
+	return counter18 * 2;
+}
+
+var counter19 = 0;
+function step19(value) {
+	counter19 += value;
+	return counter19 * 2;
+}
+
+var counter20 = 0;
+function step20(value) {
+	counter20 += value;
+	return counter20 * 2;
+}
+
+var counter21 = 0;
+function step21(value) {
+	counter21 += value;
+	return counter21 * 2;
+}
+
+var counter22 = 0;
+function step22(value) {
+	counter22 += value;
+	return counter22 * 2;
+}
+
+var counter23 = 0;
+function step23(value) {
+	counter23 += value;
+	return counter23 * 2;
+}
+
+var counter24 = 0;
+function step24(value) {
+	counter24 += value;
+	return counter24 * 2;
+}
+
+var counter25 = 0;
+function step25(value) {
+	counter25 += value;
+	return counter25 * 2;
+}
+
+var counter26 = 0;
+function step26(value) {
+	counter26 += value;
+	return counter26 * 2;
+}
+
+var counter27 = 0;
+function step27(value) {
+	counter27 += value;
+	return counter27 * 2;
+}
+
+var counter28 = 0;
+function step28(value) {
+	counter28 += value;
+	return counter28 * 2;
+}
+
+var counter29 = 0;
+function step29(value) {
+	counter29 += value;
+	return counter29 * 2;
+}
+
+var counter30 = 0;
+function step30(value) {
+	counter30 += value;
+	return counter30 * 2;
+}
+
+var counter31 = 0;
+function step31(value) {
+	counter31 += value;
+	return counter31 * 2;
+}
+
+var counter32 = 0;
+function step32(value) {
+	counter32 += value;
+	return counter32 * 2;
+}
+
+var counter33 = 0;
+function step33(value) {
+	counter33 += value;
+	return counter33 * 2;
+}
+
+var counter34 = 0;
+function step34(value) {
+	counter34 += value;
+	return counter34 * 2;
+}
+
+var counter35 = 0;
+function step35(value) {
+	counter35 += value;
+	return counter35 * 2;
+}
+
+var counter36 = 0;
+function step36(value) {
+	counter36 += value;
+	return counter36 * 2;
+}
+
+var counter37 = 0;
+function step37(value) {
+	counter37 += value;
+	return counter37 * 2;
+}
+
+var counter38 = 0;
+function step38(value) {
+	counter38 += value;
+	return counter38 * 2;
+}
+
+var counter39 = 0;
+function step39(value) {
+	counter39 += value;
+	return counter39 * 2;
+}
+
+var counter40 = 0;
+function step40(value) {
+	counter40 += value;
+	return counter40 * 2;
+}
+
+var counter41 = 0;
+function step41(value) {
+	counter41 += value;
+	return counter41 * 2;
+}
+
+var counter42 = 0;
+function step42(value) {
+	counter42 += value;
+	return counter42 * 2;
+}
+
+var counter43 = 0;
+function step43(value) {
+	counter43 += value;
+	return counter43 * 2;
+}
+
+var counter44 = 0;
+function step44(value) {
+	counter44 += value;
+	return counter44 * 2;
+}
+
+var counter45 = 0;
+function step45(value) {
+	counter45 += value;
+	return counter45 * 2;
+}
+
+var counter46 = 0;
+function step46(value) {
+	counter46 += value;
+	return counter46 * 2;
+}
+
+var counter47 = 0;
+function step47(value) {
+	counter47 += value;
+	return counter47 * 2;
+}
+
+var counter48 = 0;
+function step48(value) {
+	counter48 += value;
+	return counter48 * 2;
+}
+
+var counter49 = 0;
+function step49(value) {
+	counter49 += value;
+	return counter49 * 2;
+}
+
+var counter50 = 0;
+function step50(value) {
+	counter50 += value;
+	return counter50 * 2;
+}
+
+var counter51 = 0;
+function step51(value) {
+	counter51 += value;
+	return counter51 * 2;
+}
+
+var counter52 = 0;
+function step52(value) {
+	counter52 += value;
+	return counter52 * 2;
+}
+
+var counter53 = 0;
+function step53(value) {
+	counter53 += value;
+	return counter53 * 2;
+}
+
+var counter54 = 0;
+function step54(value) {
+	counter54 += value;
+	return counter54 * 2;
+}
+
+var counter55 = 0;
+function step55(value) {
+	counter55 += value;
+	return counter55 * 2;
+}
+
+var counter56 = 0;
+function step56(value) {
+	counter56 += value;
+	return counter56 * 2;
+}
+
+var counter57 = 0;
+function step57(value) {
+	counter57 += value;
+	return counter57 * 2;
+}
+
+var counter58 = 0;
+function step58(value) {
+	counter58 += value;
+	return counter58 * 2;
+}
+
+var counter59 = 0;
+function step59(value) {
+	counter59 += value;
+	return counter59 * 2;
+}
+
+var counter60 = 0;
+function step60(value) {
+	counter60 += value;
+	return counter60 * 2;
+}
+
+var counter61 = 0;
+function step61(value) {
+	counter61 += value;
+	return counter61 * 2;
+}
+
+var counter62 = 0;
+function step62(value) {
+	counter62 += value;
+	return counter62 * 2;
+}
+
+var counter63 = 0;
+function step63(value) {
+	counter63 += value;
+	return counter63 * 2;
+}
+
+var counter64 = 0;
+function step64(value) {
+	counter64 += value;
+	return counter64 * 2;
+}
+
+var counter65 = 0;
+function step65(value) {
+	counter65 += value;
+	return counter65 * 2;
+}
+
+var counter66 = 0;
+function step66(value) {
+	counter66 += value;
+	return counter66 * 2;
+}
+
+var counter67 = 0;
+function step67(value) {
+	counter67 += value;
+	return counter67 * 2;
+}
+
+var counter68 = 0;
+function step68(value) {
+	counter68 += value;
+	return counter68 * 2;
+}
+
+var counter69 = 0;
+function step69(value) {
+	counter69 += value;
+	return counter69 * 2;
+}
+
+var counter70 = 0;
+function step70(value) {
+	counter70 += value;
+	return counter70 * 2;
+}
+
+var counter71 = 0;
+function step71(value) {
+	counter71 += value;
+	return counter71 * 2;
+}
+
+var counter72 = 0;
+function step72(value) {
+	counter72 += value;
+	return counter72 * 2;
+}
+
+var counter73 = 0;
+function step73(value) {
+	counter73 += value;
+	return counter73 * 2;
+}
+
+var counter74 = 0;
+function step74(value) {
+	counter74 += value;
+	return counter74 * 2;
+}
+
+var counter75 = 0;
+function step75(value) {
+	counter75 += value;
+	return counter75 * 2;
+}
+
+var counter76 = 0;
+function step76(value) {
+	counter76 += value;
+	return counter76 * 2;
+}
+
+var counter77 = 0;
+function step77(value) {
+	counter77 += value;
+	return counter77 * 2;
+}
+
+var counter78 = 0;
+function step78(value) {
+	counter78 += value;
+	return counter78 * 2;
+}
+
+var counter79 = 0;
+function step79(value) {
+	counter79 += value;
+	return counter79 * 2;
+}
+
+var counter80 = 0;
+function step80(value) {
+	counter80 += value;
+	return counter80 * 2;
+}
+
+var counter81 = 0;
+function step81(value) {
+	counter81 += value;
+	return counter81 * 2;
+}
+
+var counter82 = 0;
+function step82(value) {
+	counter82 += value;
+	return counter82 * 2;
+}
+
+var counter83 = 0;
+function step83(value) {
+	counter83 += value;
+	return counter83 * 2;
+}
+
+var counter84 = 0;
+function step84(value) {
+	counter84 += value;
+	return counter84 * 2;
+}
+
+var counter85 = 0;
+function step85(value) {
+	counter85 += value;
+	return counter85 * 2;
+}
+
+var counter86 = 0;
+function step86(value) {
+	counter86 += value;
+	return counter86 * 2;
+}
+
+var counter87 = 0;
+function step87(value) {
+	counter87 += value;
+	return counter87 * 2;
+}
+
+print('done');
@@ -0,0 +1,625 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Fake CDC ACM device and the USB host on the other end of it
+ *
+ * The device side follows the Zephyr cdc_acm driver with the NAK patch in
+ * zephyr_driver_acm_patch.txt applied: OUT packets go into a small internal
+ * buffer and a packet that does not fit stays with the host, which retries
+ * until there is room. With drop set it behaves like the stock driver and
+ * discards whatever does not fit. With endpoint set the packet stays in the
+ * device instead and uart_fifo_read pulls it in as soon as it fits, so new
+ * data shows up in the middle of the application's own callback.
+ *
+ * The driver callback is never entered twice. A callback raised while the
+ * last one is still running is counted as nested and not delivered.
+ *
+ * A USB thread plays the host controller. It delivers queued data in 64
+ * byte packets paced to the configured rate and burst size, completes IN
+ * transfers after a fixed delay and calls the driver callback with the
+ * interrupt lock held, the way the USB interrupt would.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nanokernel.h>
+#include <device.h>
+#include <uart.h>
+
+#include "sim.h"
+
+/* Device output kept around for expect */
+#define OUT_WINDOW (64 * 1024)
+
+/* How often the host retries a packet the device NAKed */
+#define NAK_RETRY_US 50
+
+static struct device cdc_dev = {
+	.name = CONFIG_CDC_ACM_PORT_NAME,
+};
+
+/* Driver state, guarded by the interrupt lock */
+static struct {
+	uart_irq_callback_t cb;
+	uint8_t rx_buf[SIM_CDC_BUFFER_SIZE];
+	uint32_t rx_head;
+	uint32_t rx_tail;
+	bool rx_irq_ena;
+	bool tx_irq_ena;
+	bool tx_ready;
+	bool in_cb;
+	uint64_t tx_done_at;
+	/* OUT packet held in the endpoint */
+	uint8_t ep_buf[SIM_USB_MPS];
+	uint32_t ep_len;
+	struct sim_cdc_stats stats;
+} cdc = {
+	.tx_ready = true,
+};
+
+/* Host side, guarded by host_mutex */
+static pthread_mutex_t host_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t host_cond;
+static struct sim_cdc_config host_config;
+static uint8_t *host_queue;
+static size_t host_len;
+static size_t host_pos;
+static size_t host_cap;
+static bool host_ready;
+static bool host_nak;
+
+/* Device output, guarded by out_mutex */
+static pthread_mutex_t out_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t out_cond;
+static char out_window[OUT_WINDOW];
+static uint64_t out_total;
+static int out_fd = -1;
+
+static void cond_init(pthread_cond_t *cond) {
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static void deadline_us(struct timespec *ts, uint64_t usec) {
+	ts->tv_sec = usec / 1000000;
+	ts->tv_nsec = (usec % 1000000) * 1000;
+}
+
+/*************************** DRIVER ************************************/
+
+struct device *device_get_binding(const char *name) {
+	if (strcmp(name, cdc_dev.name) == 0)
+		return &cdc_dev;
+	return sim_flash_binding(name);
+}
+
+static uint32_t cdc_rx_used(void) {
+	return cdc.rx_head - cdc.rx_tail;
+}
+
+/* The interrupt lock is held, as it would be in the USB interrupt */
+static void cdc_interrupt(void) {
+	if (cdc.cb == NULL)
+		return;
+
+	if (cdc.in_cb) {
+		cdc.stats.nested_irqs++;
+		return;
+	}
+
+	cdc.stats.irqs++;
+	cdc.in_cb = true;
+	cdc.cb(&cdc_dev);
+	cdc.in_cb = false;
+}
+
+/* Moves the packet held in the endpoint into the buffer once it fits */
+static void cdc_ep_pull(void) {
+	uint32_t i;
+
+	if (cdc.ep_len == 0 || cdc.ep_len > SIM_CDC_BUFFER_SIZE - 1 - cdc_rx_used())
+		return;
+
+	for (i = 0; i < cdc.ep_len; i++)
+		cdc.rx_buf[(cdc.rx_head + i) % SIM_CDC_BUFFER_SIZE] = cdc.ep_buf[i];
+	cdc.rx_head += cdc.ep_len;
+	cdc.stats.rx_bytes += cdc.ep_len;
+	cdc.stats.rx_packets++;
+	cdc.ep_len = 0;
+}
+
+static void out_capture(const uint8_t *data, int size) {
+	int i;
+
+	pthread_mutex_lock(&out_mutex);
+	if (out_fd >= 0 && write(out_fd, data, size) < 0)
+		out_fd = -1;
+
+	for (i = 0; i < size; i++)
+		out_window[(out_total + i) % OUT_WINDOW] = data[i];
+	out_total += size;
+	pthread_cond_broadcast(&out_cond);
+	pthread_mutex_unlock(&out_mutex);
+}
+
+int uart_fifo_fill(struct device *dev, const uint8_t *tx_data, int size) {
+	unsigned int key = irq_lock();
+
+	ARG_UNUSED(dev);
+
+	/* Previous packet still with the host */
+	if (cdc.tx_done_at) {
+		irq_unlock(key);
+		return 0;
+	}
+
+	if (size > SIM_USB_MPS)
+		size = SIM_USB_MPS;
+
+	out_capture(tx_data, size);
+	cdc.stats.tx_bytes += size;
+	cdc.stats.tx_packets++;
+	cdc.tx_ready = false;
+	cdc.tx_done_at = sim_now_us() + host_config.tx_delay_us + 1;
+
+	pthread_mutex_lock(&host_mutex);
+	pthread_cond_signal(&host_cond);
+	pthread_mutex_unlock(&host_mutex);
+
+	irq_unlock(key);
+	return size;
+}
+
+int uart_fifo_read(struct device *dev, uint8_t *rx_data, const int size) {
+	unsigned int key = irq_lock();
+	uint32_t len = cdc_rx_used();
+	uint32_t i;
+
+	ARG_UNUSED(dev);
+
+	if (len > (uint32_t)size)
+		len = size;
+
+	for (i = 0; i < len; i++)
+		rx_data[i] = cdc.rx_buf[(cdc.rx_tail + i) % SIM_CDC_BUFFER_SIZE];
+	cdc.rx_tail += len;
+
+	/* Data the caller has not seen yet, without calling it back */
+	cdc_ep_pull();
+
+	irq_unlock(key);
+	return len;
+}
+
+void uart_irq_tx_enable(struct device *dev) {
+	unsigned int key = irq_lock();
+
+	ARG_UNUSED(dev);
+	cdc.tx_irq_ena = true;
+	irq_unlock(key);
+}
+
+void uart_irq_tx_disable(struct device *dev) {
+	unsigned int key = irq_lock();
+
+	ARG_UNUSED(dev);
+	cdc.tx_irq_ena = false;
+	irq_unlock(key);
+}
+
+int uart_irq_tx_ready(struct device *dev) {
+	ARG_UNUSED(dev);
+	return cdc.tx_ready;
+}
+
+void uart_irq_rx_enable(struct device *dev) {
+	unsigned int key = irq_lock();
+
+	ARG_UNUSED(dev);
+	cdc.rx_irq_ena = true;
+
+	pthread_mutex_lock(&host_mutex);
+	host_ready = true;
+	pthread_cond_broadcast(&host_cond);
+	pthread_mutex_unlock(&host_mutex);
+
+	/* The patched driver delivers what it held back while disabled */
+	if (!host_config.drop) {
+		cdc_ep_pull();
+		if (cdc_rx_used() > 0)
+			cdc_interrupt();
+	}
+
+	irq_unlock(key);
+}
+
+void uart_irq_rx_disable(struct device *dev) {
+	unsigned int key = irq_lock();
+
+	ARG_UNUSED(dev);
+	cdc.rx_irq_ena = false;
+	irq_unlock(key);
+}
+
+int uart_irq_rx_ready(struct device *dev) {
+	ARG_UNUSED(dev);
+	return cdc_rx_used() > 0;
+}
+
+int uart_irq_is_pending(struct device *dev) {
+	ARG_UNUSED(dev);
+	return (cdc.rx_irq_ena && cdc_rx_used() > 0) ||
+		(cdc.tx_irq_ena && cdc.tx_ready);
+}
+
+int uart_irq_update(struct device *dev) {
+	ARG_UNUSED(dev);
+	return 1;
+}
+
+void uart_irq_callback_set(struct device *dev, uart_irq_callback_t cb) {
+	unsigned int key = irq_lock();
+
+	ARG_UNUSED(dev);
+	cdc.cb = cb;
+	irq_unlock(key);
+}
+
+int uart_line_ctrl_set(struct device *dev, uint32_t ctrl, uint32_t val) {
+	ARG_UNUSED(dev);
+	ARG_UNUSED(ctrl);
+	ARG_UNUSED(val);
+	return 0;
+}
+
+/* The host terminal is always open */
+int uart_line_ctrl_get(struct device *dev, uint32_t ctrl, uint32_t *val) {
+	ARG_UNUSED(dev);
+
+	switch (ctrl) {
+	case LINE_CTRL_BAUD_RATE:
+		*val = 115200;
+		return 0;
+	case LINE_CTRL_DTR:
+		*val = 1;
+		return 0;
+	}
+	return -ENOTSUP;
+}
+
+/*************************** USB HOST **********************************/
+
+/*
+ * @brief Hands one OUT packet to the driver
+ * @return false if the device NAKed it and it has to be sent again
+ */
+static bool usb_out_packet(const uint8_t *data, uint32_t len) {
+	unsigned int key = irq_lock();
+	uint32_t room = SIM_CDC_BUFFER_SIZE - 1 - cdc_rx_used();
+	uint32_t i;
+
+	/* The endpoint is busy until the driver has taken its packet */
+	if (cdc.ep_len > 0) {
+		irq_unlock(key);
+		return false;
+	}
+
+	if (len > room && host_config.endpoint && !host_config.drop) {
+		memcpy(cdc.ep_buf, data, len);
+		cdc.ep_len = len;
+		cdc.stats.rx_naks++;
+
+		if (cdc.rx_irq_ena && cdc_rx_used() > 0)
+			cdc_interrupt();
+		irq_unlock(key);
+		return true;
+	}
+
+	if (len > room) {
+		if (!host_config.drop) {
+			/* Count each packet once, not every retry */
+			if (!host_nak)
+				cdc.stats.rx_naks++;
+			host_nak = true;
+
+			/* The patched driver still lets the application know */
+			if (cdc.rx_irq_ena && cdc_rx_used() > 0)
+				cdc_interrupt();
+			irq_unlock(key);
+			return false;
+		}
+
+		cdc.stats.rx_dropped += len - room;
+		len = room;
+	}
+
+	for (i = 0; i < len; i++)
+		cdc.rx_buf[(cdc.rx_head + i) % SIM_CDC_BUFFER_SIZE] = data[i];
+	cdc.rx_head += len;
+	cdc.stats.rx_bytes += len;
+	cdc.stats.rx_packets++;
+	host_nak = false;
+
+	if (cdc.rx_irq_ena)
+		cdc_interrupt();
+
+	irq_unlock(key);
+	return true;
+}
+
+/*
+ * @brief Sends whatever the rate allows
+ * @return Time at which the host has something to do again, 0 if idle
+ */
+static uint64_t usb_out(uint64_t now) {
+	static uint64_t burst_start;
+	static uint32_t burst_sent;
+	uint8_t packet[SIM_USB_MPS];
+	uint32_t len, rate, burst;
+
+	for (;;) {
+		pthread_mutex_lock(&host_mutex);
+		rate = host_config.rate;
+		burst = host_config.burst;
+		len = host_len - host_pos;
+		if (len > SIM_USB_MPS)
+			len = SIM_USB_MPS;
+		if (rate && len > burst - burst_sent)
+			len = burst - burst_sent;
+		memcpy(packet, host_queue + host_pos, len);
+		pthread_mutex_unlock(&host_mutex);
+
+		if (len == 0)
+			return 0;
+
+		if (rate && burst_sent == 0) {
+			if (now < burst_start)
+				return burst_start;
+			burst_start = now;
+		}
+
+		if (!usb_out_packet(packet, len))
+			return now + NAK_RETRY_US;
+
+		pthread_mutex_lock(&host_mutex);
+		host_pos += len;
+		pthread_mutex_unlock(&host_mutex);
+
+		if (rate) {
+			burst_sent += len;
+			if (burst_sent >= burst) {
+				burst_start += (uint64_t)burst_sent * 1000000 / rate;
+				burst_sent = 0;
+			}
+		}
+
+		now = sim_now_us();
+	}
+}
+
+/*
+ * @brief Collects the IN packet once its time is up
+ * @return Time of the pending completion, 0 if nothing is in flight
+ */
+static uint64_t usb_in(uint64_t now) {
+	unsigned int key = irq_lock();
+	uint64_t done_at = cdc.tx_done_at;
+
+	if (done_at && now >= done_at) {
+		cdc.tx_done_at = 0;
+		done_at = 0;
+		cdc.tx_ready = true;
+		if (cdc.tx_irq_ena)
+			cdc_interrupt();
+	}
+
+	irq_unlock(key);
+	return done_at;
+}
+
+static void *usb_thread(void *arg) {
+	struct timespec ts;
+	uint64_t now, wake, next;
+
+	ARG_UNUSED(arg);
+
+	for (;;) {
+		now = sim_now_us();
+		wake = now + 10000;
+
+		next = usb_in(now);
+		if (next && next < wake)
+			wake = next;
+
+		next = usb_out(now);
+		if (next && next < wake)
+			wake = next;
+
+		pthread_mutex_lock(&host_mutex);
+		deadline_us(&ts, wake);
+		pthread_cond_timedwait(&host_cond, &host_mutex, &ts);
+		pthread_mutex_unlock(&host_mutex);
+	}
+	return NULL;
+}
+
+/*************************** CONTROL ***********************************/
+
+void sim_cdc_start(const struct sim_cdc_config *config, int fd) {
+	pthread_t thread;
+
+	cond_init(&host_cond);
+	cond_init(&out_cond);
+
+	host_config = *config;
+	if (host_config.burst == 0)
+		host_config.burst = SIM_USB_MPS;
+	out_fd = fd;
+
+	pthread_create(&thread, NULL, usb_thread, NULL);
+}
+
+void sim_cdc_set_rate(uint32_t rate, uint32_t burst) {
+	pthread_mutex_lock(&host_mutex);
+	host_config.rate = rate;
+	if (burst)
+		host_config.burst = burst;
+	pthread_cond_signal(&host_cond);
+	pthread_mutex_unlock(&host_mutex);
+}
+
+void sim_cdc_set_endpoint(bool endpoint) {
+	pthread_mutex_lock(&host_mutex);
+	host_config.endpoint = endpoint;
+	pthread_mutex_unlock(&host_mutex);
+}
+
+void sim_cdc_set_output(int fd) {
+	pthread_mutex_lock(&out_mutex);
+	out_fd = fd;
+	pthread_mutex_unlock(&out_mutex);
+}
+
+void sim_cdc_wait_ready(void) {
+	pthread_mutex_lock(&host_mutex);
+	while (!host_ready)
+		pthread_cond_wait(&host_cond, &host_mutex);
+	pthread_mutex_unlock(&host_mutex);
+}
+
+void sim_cdc_send(const void *buf, size_t len) {
+	pthread_mutex_lock(&host_mutex);
+
+	/* Drop what has been delivered before growing the queue */
+	if (host_pos == host_len) {
+		host_pos = 0;
+		host_len = 0;
+	}
+
+	if (host_len + len > host_cap) {
+		host_cap = (host_len + len) * 2;
+		host_queue = realloc(host_queue, host_cap);
+	}
+
+	memcpy(host_queue + host_len, buf, len);
+	host_len += len;
+	pthread_cond_signal(&host_cond);
+	pthread_mutex_unlock(&host_mutex);
+}
+
+bool sim_cdc_rx_idle(void) {
+	unsigned int key;
+	bool idle;
+
+	pthread_mutex_lock(&host_mutex);
+	idle = host_pos == host_len;
+	pthread_mutex_unlock(&host_mutex);
+
+	key = irq_lock();
+	idle = idle && cdc_rx_used() == 0 && cdc.ep_len == 0;
+	irq_unlock(key);
+	return idle;
+}
+
+uint64_t sim_cdc_tx_total(void) {
+	uint64_t total;
+
+	pthread_mutex_lock(&out_mutex);
+	total = out_total;
+	pthread_mutex_unlock(&out_mutex);
+	return total;
+}
+
+uint64_t sim_cdc_expect(const char *text, uint64_t from, uint32_t timeout_ms) {
+	static char linear[OUT_WINDOW];
+	size_t text_len = strlen(text);
+	uint64_t start, i, end = 0;
+	struct timespec ts;
+	char *match;
+
+	deadline_us(&ts, sim_now_us() + (uint64_t)timeout_ms * 1000);
+
+	pthread_mutex_lock(&out_mutex);
+	for (;;) {
+		start = from;
+		if (out_total > OUT_WINDOW && start < out_total - OUT_WINDOW)
+			start = out_total - OUT_WINDOW;
+
+		for (i = start; i < out_total; i++)
+			linear[i - start] = out_window[i % OUT_WINDOW];
+
+		match = memmem(linear, out_total - start, text, text_len);
+		if (match) {
+			end = start + (match - linear) + text_len;
+			break;
+		}
+
+		if (pthread_cond_timedwait(&out_cond, &out_mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&out_mutex);
+	return end;
+}
+
+size_t sim_cdc_output_read(uint64_t from, char *buf, size_t len) {
+	size_t i;
+
+	pthread_mutex_lock(&out_mutex);
+	if (out_total > OUT_WINDOW && from < out_total - OUT_WINDOW)
+		from = out_total - OUT_WINDOW;
+
+	for (i = 0; i < len && from + i < out_total; i++)
+		buf[i] = out_window[(from + i) % OUT_WINDOW];
+	pthread_mutex_unlock(&out_mutex);
+	return i;
+}
+
+uint64_t sim_cdc_wait_output(uint64_t from, uint32_t timeout_ms) {
+	uint64_t total = 0;
+	struct timespec ts;
+
+	deadline_us(&ts, sim_now_us() + (uint64_t)timeout_ms * 1000);
+
+	pthread_mutex_lock(&out_mutex);
+	while (out_total <= from) {
+		if (pthread_cond_timedwait(&out_cond, &out_mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+	if (out_total > from)
+		total = out_total;
+	pthread_mutex_unlock(&out_mutex);
+	return total;
+}
+
+void sim_cdc_stats_get(struct sim_cdc_stats *stats) {
+	unsigned int key = irq_lock();
+
+	*stats = cdc.stats;
+	irq_unlock(key);
+}
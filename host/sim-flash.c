@@ -0,0 +1,116 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Internal flash stand-in for the raw code partition
+ *
+ * Behaves like NOR flash: erasing sets whole pages to 0xFF, writing can
+ * only clear bits and goes a word at a time.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <flash.h>
+
+#include "code-flash.h"
+#include "sim.h"
+
+#define SIM_FLASH_WORD 4
+
+uint8_t sim_flash[CONFIG_CODE_FLASH_SIZE];
+
+static struct device flash_dev = {
+	.name = CONFIG_CODE_FLASH_DEV_NAME,
+};
+
+static bool write_protected = true;
+static uint64_t flash_written;
+
+uint64_t sim_flash_written(void) {
+	return __atomic_load_n(&flash_written, __ATOMIC_RELAXED);
+}
+
+struct device *sim_flash_binding(const char *name) {
+	static bool erased;
+
+	if (strcmp(name, flash_dev.name))
+		return NULL;
+
+	if (!erased) {
+		memset(sim_flash, 0xFF, sizeof(sim_flash));
+		erased = true;
+	}
+	return &flash_dev;
+}
+
+/* Turns an address into an offset in the array, -1 if it is outside */
+static long sim_flash_offset(off_t address, size_t len) {
+	uintptr_t start = (uintptr_t)sim_flash;
+
+	if ((uintptr_t)address < start ||
+		(uintptr_t)address + len > start + sizeof(sim_flash))
+		return -1;
+	return (long)((uintptr_t)address - start);
+}
+
+int flash_read(struct device *dev, off_t offset, void *data, size_t len) {
+	long at = sim_flash_offset(offset, len);
+
+	(void)dev;
+	if (at < 0)
+		return -EINVAL;
+	memcpy(data, &sim_flash[at], len);
+	return 0;
+}
+
+int flash_write(struct device *dev, off_t offset, const void *data, size_t len) {
+	long at = sim_flash_offset(offset, len);
+	const uint8_t *bytes = data;
+	size_t t;
+
+	(void)dev;
+	if (at < 0 || (at % SIM_FLASH_WORD) || (len % SIM_FLASH_WORD))
+		return -EINVAL;
+	if (write_protected)
+		return -EACCES;
+
+	for (t = 0; t < len; t++)
+		sim_flash[at + t] &= bytes[t];
+	__atomic_add_fetch(&flash_written, len, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int flash_erase(struct device *dev, off_t offset, size_t size) {
+	long at = sim_flash_offset(offset, size);
+
+	(void)dev;
+	if (at < 0 || (at % CONFIG_CODE_FLASH_PAGE_SIZE) ||
+		(size % CONFIG_CODE_FLASH_PAGE_SIZE))
+		return -EINVAL;
+	if (write_protected)
+		return -EACCES;
+
+	memset(&sim_flash[at], 0xFF, size);
+	return 0;
+}
+
+int flash_write_protection_set(struct device *dev, bool enable) {
+	(void)dev;
+	write_protected = enable;
+	return 0;
+}
@@ -0,0 +1,181 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief File system calls mapped onto a directory of the host
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#include "sim.h"
+
+/* Leaves room in PATH_MAX for the file names */
+static char fs_root[PATH_MAX / 2] = ".";
+
+static uint64_t fs_written;
+
+void sim_fs_init(const char *root) {
+	snprintf(fs_root, sizeof(fs_root), "%s", root);
+	mkdir(fs_root, 0755);
+}
+
+uint64_t sim_fs_written(void) {
+	return __atomic_load_n(&fs_written, __ATOMIC_RELAXED) + sim_flash_written();
+}
+
+static const char *fs_path(const char *name, char *path) {
+	while (*name == '/')
+		name++;
+	snprintf(path, PATH_MAX, "%s/%s", fs_root, name);
+	return path;
+}
+
+/* Like FatFs, opening a file creates it if it is not there */
+int fs_open(ZFILE *zfp, const char *file_name) {
+	char path[PATH_MAX];
+
+	zfp->fd = open(fs_path(file_name, path), O_RDWR | O_CREAT, 0644);
+	return zfp->fd < 0 ? -errno : 0;
+}
+
+int fs_close(ZFILE *zfp) {
+	int res = close(zfp->fd);
+
+	zfp->fd = -1;
+	return res ? -errno : 0;
+}
+
+int fs_unlink(const char *path) {
+	char full[PATH_MAX];
+
+	return unlink(fs_path(path, full)) ? -errno : 0;
+}
+
+ssize_t fs_read(ZFILE *zfp, void *ptr, size_t size) {
+	ssize_t res = read(zfp->fd, ptr, size);
+
+	return res < 0 ? -errno : res;
+}
+
+ssize_t fs_write(ZFILE *zfp, const void *ptr, size_t size) {
+	ssize_t res = write(zfp->fd, ptr, size);
+
+	if (res < 0)
+		return -errno;
+	__atomic_add_fetch(&fs_written, res, __ATOMIC_RELAXED);
+	return res;
+}
+
+int fs_seek(ZFILE *zfp, off_t offset, int whence) {
+	return lseek(zfp->fd, offset, whence) < 0 ? -errno : 0;
+}
+
+off_t fs_tell(ZFILE *zfp) {
+	off_t pos = lseek(zfp->fd, 0, SEEK_CUR);
+
+	return pos < 0 ? -errno : pos;
+}
+
+int fs_truncate(ZFILE *zfp, off_t length) {
+	return ftruncate(zfp->fd, length) ? -errno : 0;
+}
+
+int fs_mkdir(const char *path) {
+	char full[PATH_MAX];
+
+	return mkdir(fs_path(path, full), 0755) ? -errno : 0;
+}
+
+int fs_opendir(ZDIR *zdp, const char *path) {
+	char full[PATH_MAX];
+
+	zdp->dir = opendir(fs_path(path, full));
+	return zdp->dir ? 0 : -errno;
+}
+
+static void fs_dirent_fill(const char *name, const struct stat *st,
+			   struct zfs_dirent *entry) {
+	/* Long names get cut like they would be on the FAT volume */
+	strncpy(entry->name, name, MAX_FILE_NAME);
+	entry->name[MAX_FILE_NAME] = '\0';
+	entry->type = S_ISDIR(st->st_mode) ? DIR_ENTRY_DIR : DIR_ENTRY_FILE;
+	entry->size = st->st_size;
+}
+
+/* An empty name marks the end of the directory */
+int fs_readdir(ZDIR *zdp, struct zfs_dirent *entry) {
+	char full[PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+
+	while ((de = readdir(zdp->dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(full, sizeof(full), "%s/%s", fs_root, de->d_name);
+		if (stat(full, &st))
+			continue;
+
+		fs_dirent_fill(de->d_name, &st, entry);
+		return 0;
+	}
+
+	entry->name[0] = '\0';
+	return 0;
+}
+
+int fs_closedir(ZDIR *zdp) {
+	return closedir(zdp->dir) ? -errno : 0;
+}
+
+int fs_stat(const char *path, struct zfs_dirent *entry) {
+	char full[PATH_MAX];
+	const char *name;
+	struct stat st;
+
+	if (stat(fs_path(path, full), &st))
+		return -errno;
+
+	name = strrchr(path, '/');
+	fs_dirent_fill(name ? name + 1 : path, &st, entry);
+	return 0;
+}
+
+int fs_statvfs(struct zfs_statvfs *stat) {
+	struct statvfs vfs;
+
+	if (statvfs(fs_root, &vfs))
+		return -errno;
+
+	stat->f_bsize = vfs.f_bsize;
+	stat->f_frsize = vfs.f_frsize;
+	stat->f_blocks = vfs.f_blocks;
+	stat->f_bfree = vfs.f_bfree;
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief JerryScript stand-in, code is accepted and counted but not run
+ */
+
+#include <misc/printk.h>
+
+#include "jerry-api.h"
+
+void jerry_init(int flags) {
+	(void)flags;
+}
+
+void jerry_cleanup(void) {
+}
+
+jerry_value_t jerry_eval(const jerry_char_t *source_p, size_t source_size,
+			 bool is_strict) {
+	(void)source_p;
+	(void)is_strict;
+	printk("[JS] eval %u bytes\n", (unsigned int)source_size);
+	return 0;
+}
+
+jerry_value_t jerry_parse(const jerry_char_t *source_p, size_t source_size,
+			  bool is_strict) {
+	(void)source_p;
+	(void)is_strict;
+	printk("[JS] parse %u bytes\n", (unsigned int)source_size);
+	return 0;
+}
+
+jerry_value_t jerry_run(const jerry_value_t func_val) {
+	(void)func_val;
+	return 0;
+}
+
+bool jerry_value_has_error_flag(const jerry_value_t value) {
+	(void)value;
+	return false;
+}
+
+void jerry_release_value(jerry_value_t value) {
+	(void)value;
+}
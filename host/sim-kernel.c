@@ -0,0 +1,324 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Nanokernel services on top of POSIX threads
+ *
+ * Semaphores and FIFOs share a single mutex and condition variable, the
+ * uploader only has a couple of waiters so broadcasting costs nothing.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nanokernel.h>
+#include <misc/printk.h>
+
+#include "sim.h"
+
+int sys_clock_ticks_per_sec = 100;
+int sys_clock_hw_cycles_per_sec = 32000000;
+
+bool sim_printk_enabled = false;
+
+static pthread_mutex_t irq_mutex;
+static pthread_once_t irq_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wait_cond;
+static pthread_once_t wait_once = PTHREAD_ONCE_INIT;
+
+/*************************** CLOCKS ************************************/
+
+uint64_t sim_now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sim_sleep_us(uint64_t usec) {
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+uint32_t sys_cycle_get_32(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * sys_clock_hw_cycles_per_sec +
+		(uint64_t)ts.tv_nsec * (sys_clock_hw_cycles_per_sec / 1000000) / 1000);
+}
+
+int64_t sys_tick_get(void) {
+	return sim_now_us() / (1000000 / sys_clock_ticks_per_sec);
+}
+
+uint32_t sys_tick_get_32(void) {
+	return (uint32_t)sys_tick_get();
+}
+
+/* The simulated host never needs time to settle */
+void sys_thread_busy_wait(uint32_t usec_to_wait) {
+	ARG_UNUSED(usec_to_wait);
+}
+
+void task_sleep(int32_t timeout_in_ticks) {
+	sim_sleep_us((uint64_t)timeout_in_ticks * 1000000 / sys_clock_ticks_per_sec);
+}
+
+void task_yield(void) {
+	sched_yield();
+}
+
+void fiber_yield(void) {
+	sched_yield();
+}
+
+uint32_t sys_kernel_version_get(void) {
+	return (1 << 24) | (5 << 16);
+}
+
+/*************************** INTERRUPTS ********************************/
+
+static void irq_mutex_init(void) {
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&irq_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+unsigned int irq_lock(void) {
+	pthread_once(&irq_once, irq_mutex_init);
+	pthread_mutex_lock(&irq_mutex);
+	return 0;
+}
+
+void irq_unlock(unsigned int key) {
+	ARG_UNUSED(key);
+	pthread_mutex_unlock(&irq_mutex);
+}
+
+/*************************** WAITING ***********************************/
+
+static void wait_cond_init(void) {
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wait_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/*
+ * @brief Sleeps on the shared condition until woken or the deadline passes
+ * @return false once the deadline has passed
+ */
+static bool wait_until(const struct timespec *deadline) {
+	if (deadline == NULL) {
+		pthread_cond_wait(&wait_cond, &wait_mutex);
+		return true;
+	}
+
+	return pthread_cond_timedwait(&wait_cond, &wait_mutex, deadline) != ETIMEDOUT;
+}
+
+static struct timespec *wait_deadline(int32_t timeout, struct timespec *ts) {
+	uint64_t usec;
+
+	if (timeout == TICKS_UNLIMITED)
+		return NULL;
+
+	usec = (uint64_t)timeout * 1000000 / sys_clock_ticks_per_sec;
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += usec / 1000000;
+	ts->tv_nsec += (usec % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+/*************************** SEMAPHORES ********************************/
+
+void nano_sem_init(struct nano_sem *sem) {
+	pthread_once(&wait_once, wait_cond_init);
+	pthread_mutex_lock(&wait_mutex);
+	sem->count = 0;
+	pthread_mutex_unlock(&wait_mutex);
+}
+
+void nano_sem_give(struct nano_sem *sem) {
+	pthread_once(&wait_once, wait_cond_init);
+	pthread_mutex_lock(&wait_mutex);
+	sem->count++;
+	pthread_cond_broadcast(&wait_cond);
+	pthread_mutex_unlock(&wait_mutex);
+}
+
+void nano_isr_sem_give(struct nano_sem *sem) {
+	nano_sem_give(sem);
+}
+
+void nano_task_sem_give(struct nano_sem *sem) {
+	nano_sem_give(sem);
+}
+
+void nano_fiber_sem_give(struct nano_sem *sem) {
+	nano_sem_give(sem);
+}
+
+int nano_sem_take(struct nano_sem *sem, int32_t timeout) {
+	struct timespec ts, *deadline = wait_deadline(timeout, &ts);
+	int taken = 0;
+
+	pthread_once(&wait_once, wait_cond_init);
+	pthread_mutex_lock(&wait_mutex);
+	while (sem->count == 0 && timeout != TICKS_NONE) {
+		if (!wait_until(deadline))
+			break;
+	}
+
+	if (sem->count > 0) {
+		sem->count--;
+		taken = 1;
+	}
+	pthread_mutex_unlock(&wait_mutex);
+	return taken;
+}
+
+int nano_task_sem_take(struct nano_sem *sem, int32_t timeout) {
+	return nano_sem_take(sem, timeout);
+}
+
+int nano_fiber_sem_take(struct nano_sem *sem, int32_t timeout) {
+	return nano_sem_take(sem, timeout);
+}
+
+/*************************** FIFOS *************************************/
+
+void nano_fifo_init(struct nano_fifo *fifo) {
+	pthread_once(&wait_once, wait_cond_init);
+	pthread_mutex_lock(&wait_mutex);
+	fifo->head = NULL;
+	fifo->tail = NULL;
+	pthread_mutex_unlock(&wait_mutex);
+}
+
+void nano_fifo_put(struct nano_fifo *fifo, void *data) {
+	pthread_once(&wait_once, wait_cond_init);
+	pthread_mutex_lock(&wait_mutex);
+	*(void **)data = NULL;
+	if (fifo->tail)
+		*(void **)fifo->tail = data;
+	else
+		fifo->head = data;
+	fifo->tail = data;
+	pthread_cond_broadcast(&wait_cond);
+	pthread_mutex_unlock(&wait_mutex);
+}
+
+void nano_isr_fifo_put(struct nano_fifo *fifo, void *data) {
+	nano_fifo_put(fifo, data);
+}
+
+void nano_task_fifo_put(struct nano_fifo *fifo, void *data) {
+	nano_fifo_put(fifo, data);
+}
+
+void *nano_fifo_get(struct nano_fifo *fifo, int32_t timeout) {
+	struct timespec ts, *deadline = wait_deadline(timeout, &ts);
+	void *data;
+
+	pthread_once(&wait_once, wait_cond_init);
+	pthread_mutex_lock(&wait_mutex);
+	while (fifo->head == NULL && timeout != TICKS_NONE) {
+		if (!wait_until(deadline))
+			break;
+	}
+
+	data = fifo->head;
+	if (data) {
+		fifo->head = *(void **)data;
+		if (fifo->head == NULL)
+			fifo->tail = NULL;
+	}
+	pthread_mutex_unlock(&wait_mutex);
+	return data;
+}
+
+void *nano_isr_fifo_get(struct nano_fifo *fifo, int32_t timeout) {
+	return nano_fifo_get(fifo, timeout);
+}
+
+void *nano_task_fifo_get(struct nano_fifo *fifo, int32_t timeout) {
+	return nano_fifo_get(fifo, timeout);
+}
+
+/*************************** CONSOLE ***********************************/
+
+/* printk goes to the board console, which is stderr here */
+int printk(const char *fmt, ...) {
+	va_list args;
+	int ret;
+
+	if (!sim_printk_enabled)
+		return 0;
+
+	va_start(args, fmt);
+	ret = vfprintf(stderr, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+static int (*stdout_hook)(int c);
+
+void __stdout_hook_install(int (*hook)(int)) {
+	stdout_hook = hook;
+}
+
+static ssize_t stdout_write(void *cookie, const char *buf, size_t size) {
+	size_t i;
+
+	ARG_UNUSED(cookie);
+	if (stdout_hook == NULL)
+		return fwrite(buf, 1, size, stderr);
+
+	for (i = 0; i < size; i++)
+		stdout_hook((unsigned char)buf[i]);
+	return size;
+}
+
+void sim_stdout_init(void) {
+	cookie_io_functions_t io = { .write = stdout_write };
+
+	stdout = fopencookie(NULL, "w", io);
+	setvbuf(stdout, NULL, _IONBF, 0);
+}
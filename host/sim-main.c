@@ -0,0 +1,926 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Runs the uploader on the host against a scripted or pty driven host
+ *
+ * The acm task, the shell and the IHEX handler are the real sources from
+ * src/, only the kernel, the CDC ACM driver, the file system and the
+ * JavaScript engine are stand-ins. Scripts are plain text, one command per
+ * line:
+ *
+ *   rate <bytes/s> [burst]  Pace the host, 0 sends as fast as possible
+ *   endpoint <0|1>          Hold a packet that does not fit in the device
+ *                           and pull it in from inside uart_fifo_read
+ *   send <text>             Send text, C escapes like \r and \x1a work
+ *   type <text>             Send one key at a time and time every echo
+ *   typedelay <ms>          Pause between keys for type
+ *   file <path>             Send a file as it is
+ *   hexfile <path>          Send a file encoded as Intel HEX
+ *   hexfiles <path>...      Send several files in one Intel HEX upload,
+ *                           each one after a record with its name.
+ *                           corrupt counts the name records too
+ *   binfile <path>          Send a file in binary frames
+ *   corrupt <unit>          Break the checksum of that data record or frame,
+ *                           counting from 1, in the next upload
+ *   lose <unit>             Leave that data record or frame out of the next
+ *                           upload, as if it was lost whole
+ *   repeat <unit>           Send that data record or frame twice in the next
+ *                           upload, like a host that rewound to its last ack
+ *   hexresume <path>        Wait for "[RESEND] <address>" and send the file
+ *                           again from there
+ *   binresume <path>        The same in binary frames
+ *   hexfilesresume <path>...
+ *                           The same for hexfiles, from an empty name record
+ *                           and the name of the file the device announced
+ *                           last
+ *   shuffle <records>       hexfile sends groups of that many records in
+ *                           reverse order, 0 goes back to address order.
+ *                           corrupt counts the records as they are sent
+ *   window <bytes>          Keep at most that much data of an upload unacked,
+ *                           needs "set ack bytes" on the device. Resend
+ *                           requests are answered on the fly
+ *   expect <text>           Wait for the device to print text
+ *   timeout <ms>            How long expect and drain wait
+ *   sleep <ms>              Do nothing for a while
+ *   drain                   Wait until the device has taken everything
+ *   mark                    Start measuring throughput
+ *   report <label>          Print throughput since mark, on the wire and
+ *                           written to files
+ *   status                  Print the uploader status, even with -q
+ *   trace                   Print the uploader trace ring, even with -q
+ *
+ * Results and errors go to stderr, the device output to stdout.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <nanokernel.h>
+
+#include "uart-uploader.h"
+#include "acm-shell.h"
+#include "uploader-trace.h"
+#include "binary-handler.h"
+#include "ihex-handler.h"
+#include "jerry-api.h"
+#include "ihex/kk_ihex_read.h"
+
+#include "sim.h"
+
+/* Device task entry point, listed in prj.mdef on the board */
+extern void acm(void);
+extern uint32_t bytes_processed;
+
+#define DEFAULT_TIMEOUT_MS 5000
+#define DRAIN_QUIET_MS 50
+#define HEX_RECORD_SIZE 16
+/* Small enough for compressed uploads too */
+#define BINARY_FRAME_SIZE BINARY_LZ_MAX_PAYLOAD
+
+struct script {
+	const char *name;
+	int line;
+	uint32_t timeout_ms;
+	uint32_t type_delay_ms;
+	uint64_t expect_from;
+	uint64_t mark_us;
+	uint64_t mark_bytes;
+	uint64_t mark_written;
+	int out_fd;
+
+	/* Data bytes hexfile keeps in flight, 0 sends without waiting */
+	uint32_t window;
+	uint64_t ack_from;
+
+	/* Device output since the last hexfiles, for its [FILE] lines */
+	uint64_t files_from;
+};
+
+static struct {
+	uint32_t count;
+	uint64_t total_us;
+	uint64_t max_us;
+} keys;
+
+static volatile sig_atomic_t stop;
+
+/* Record or frame of the next upload that goes out with a bad checksum */
+static uint32_t corrupt_unit;
+
+/* Record or frame of the next upload that is not sent at all */
+static uint32_t lose_unit;
+
+/* Record or frame of the next upload that is sent twice */
+static uint32_t repeat_unit;
+
+/* hexfile sends groups of this many records last one first */
+static uint32_t shuffle_records;
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"Usage: %s [options] [script]\n"
+		"  -r <bytes/s>  Host to device rate, 0 is unlimited (default)\n"
+		"  -b <bytes>    Bytes sent back to back at that rate (default 64)\n"
+		"  -t <us>       Time the host takes to collect an IN packet (default 125)\n"
+		"  -d            Drop data like the stock driver instead of NAKing\n"
+		"  -f <dir>      Directory that holds the device files (default sim-fs)\n"
+		"  -p            Attach the device to a pty instead of running a script\n"
+		"  -q            Do not copy the device output to stdout\n"
+		"  -v            Show printk output\n"
+		"Without a script, commands are read from stdin.\n", name);
+}
+
+static void *acm_task(void *arg) {
+	ARG_UNUSED(arg);
+	acm();
+	return NULL;
+}
+
+/*************************** SCRIPT ************************************/
+
+static void print_stats(void) {
+	struct sim_cdc_stats stats;
+
+	sim_cdc_stats_get(&stats);
+	fprintf(stderr, "[Host] Rx %llu bytes %llu packets NAK %llu Dropped %llu\n",
+		(unsigned long long)stats.rx_bytes,
+		(unsigned long long)stats.rx_packets,
+		(unsigned long long)stats.rx_naks,
+		(unsigned long long)stats.rx_dropped);
+	fprintf(stderr, "[Host] Tx %llu bytes %llu packets Interrupts %llu "
+		"Nested %llu\n",
+		(unsigned long long)stats.tx_bytes,
+		(unsigned long long)stats.tx_packets,
+		(unsigned long long)stats.irqs,
+		(unsigned long long)stats.nested_irqs);
+
+	if (keys.count)
+		fprintf(stderr, "[Keys] %u Echo avg %llu us max %llu us\n", keys.count,
+			(unsigned long long)(keys.total_us / keys.count),
+			(unsigned long long)keys.max_us);
+}
+
+static void script_fail(struct script *script, const char *fmt, const char *arg) {
+	fprintf(stderr, "%s:%d: ", script->name, script->line);
+	fprintf(stderr, fmt, arg);
+	fprintf(stderr, "\n");
+	print_stats();
+	exit(1);
+}
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * @brief Resolves C style escapes in place
+ * @return Length of the result, which may contain zeros
+ */
+static size_t unescape(char *str) {
+	char *start = str, *out = str;
+	int hi, lo;
+
+	while (*str) {
+		if (*str != '\\' || str[1] == '\0') {
+			*out++ = *str++;
+			continue;
+		}
+
+		str++;
+		switch (*str) {
+		case 'r':
+			*out++ = '\r';
+			break;
+		case 'n':
+			*out++ = '\n';
+			break;
+		case 't':
+			*out++ = '\t';
+			break;
+		case 'e':
+			*out++ = 0x1b;
+			break;
+		case 'x':
+			hi = hex_value(str[1]);
+			lo = hi < 0 ? -1 : hex_value(str[2]);
+			if (lo < 0) {
+				*out++ = 'x';
+				break;
+			}
+			*out++ = (char)(hi << 4 | lo);
+			str += 2;
+			break;
+		default:
+			*out++ = *str;
+			break;
+		}
+		str++;
+	}
+
+	*out = '\0';
+	return out - start;
+}
+
+static char *read_file(struct script *script, const char *path, size_t *size) {
+	FILE *file = fopen(path, "rb");
+	char *data;
+	long len;
+
+	if (file == NULL)
+		script_fail(script, "cannot open %s", path);
+
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data = malloc(len + 1);
+	if (fread(data, 1, len, file) != (size_t)len)
+		script_fail(script, "cannot read %s", path);
+	fclose(file);
+
+	*size = len;
+	return data;
+}
+
+static void send_record(uint8_t type, uint16_t address, const uint8_t *data,
+			uint8_t len, bool corrupt) {
+	char line[16 + 2 * 255];
+	uint8_t sum = len + (address >> 8) + (address & 0xFF) + type;
+	int pos, i;
+
+	pos = sprintf(line, ":%02X%04X%02X", len, address, type);
+	for (i = 0; i < len; i++) {
+		pos += sprintf(line + pos, "%02X", data[i]);
+		sum += data[i];
+	}
+	if (corrupt)
+		sum++;
+	pos += sprintf(line + pos, "%02X\r\n", (uint8_t)-sum);
+	sim_cdc_send(line, pos);
+}
+
+/*
+ * @brief Waits for the next "[ACK] <bytes>" or "[RESEND] <address>"
+ *
+ * An ack moves acked forward, a resend request moves address back to
+ * where the device wants the data from.
+ */
+static void wait_ack(struct script *script, uint32_t *acked,
+			 uint32_t *address) {
+	char out[4096];
+	char *line, *end, *token;
+	size_t len;
+
+	for (;;) {
+		if (!sim_cdc_wait_output(script->ack_from, script->timeout_ms))
+			script_fail(script, "%s got no ack in time", "upload");
+
+		len = sim_cdc_output_read(script->ack_from, out, sizeof(out) - 1);
+		out[len] = '\0';
+
+		/* Only whole lines, the rest is looked at again next time */
+		line = out;
+		while ((end = memchr(line, '\n', len - (line - out))) != NULL) {
+			*end = '\0';
+			if ((token = memmem(line, end - line, "[ACK] ", 6)) != NULL) {
+				*acked = strtoul(token + 6, NULL, 10);
+			} else if ((token = memmem(line, end - line, "[RESEND] ", 9))) {
+				*address = strtoul(token + 9, NULL, 16);
+				fprintf(stderr, "Resend from %u\n", (unsigned int)*address);
+			}
+			line = end + 1;
+		}
+
+		script->ack_from += line - out;
+		if (line != out)
+			return;
+
+		/* Nothing but half a line, wait for the rest */
+		sim_sleep_us(100);
+	}
+}
+
+/* Sends one record of data at address, returns the bytes it carried */
+static size_t send_hex_unit(const uint8_t *data, size_t size, uint32_t address,
+			    bool rewound, bool corrupt) {
+	uint8_t upper[2];
+	size_t len;
+
+	/* A resumed upload cannot rely on the device's upper address */
+	if (address > 0 && ((address & 0xFFFF) == 0 || rewound)) {
+		upper[0] = address >> 24;
+		upper[1] = address >> 16;
+		send_record(IHEX_EXTENDED_LINEAR_ADDRESS_RECORD, 0, upper, 2, false);
+	}
+
+	len = size - address;
+	if (len > HEX_RECORD_SIZE)
+		len = HEX_RECORD_SIZE;
+
+	send_record(IHEX_DATA_RECORD, address & 0xFFFF, data + address, len,
+		corrupt);
+	return len;
+}
+
+static void send_hex_end(size_t size) {
+	send_record(IHEX_END_OF_FILE_RECORD, 0, NULL, 0, false);
+}
+
+static void send_frame(uint8_t type, uint32_t offset, const uint8_t *data,
+		       uint16_t len, bool corrupt) {
+	uint8_t header[BINARY_HEADER_SIZE];
+	uint8_t crc[BINARY_CRC_SIZE];
+	uint32_t value;
+	int i;
+
+	header[0] = BINARY_SYNC;
+	header[1] = type;
+	header[2] = len;
+	header[3] = len >> 8;
+	for (i = 0; i < 4; i++)
+		header[4 + i] = offset >> (8 * i);
+	value = binary_crc32(0, header, 8);
+	for (i = 0; i < 4; i++)
+		header[8 + i] = value >> (8 * i);
+
+	value = binary_crc32(0, data, len);
+	if (corrupt)
+		value++;
+	for (i = 0; i < 4; i++)
+		crc[i] = value >> (8 * i);
+
+	sim_cdc_send(header, sizeof(header));
+	sim_cdc_send(data, len);
+	sim_cdc_send(crc, sizeof(crc));
+}
+
+static size_t send_binary_unit(const uint8_t *data, size_t size,
+			       uint32_t address, bool rewound, bool corrupt) {
+	size_t len = size - address;
+
+	if (len > BINARY_FRAME_SIZE)
+		len = BINARY_FRAME_SIZE;
+
+	send_frame(BINARY_FRAME_DATA, address, data + address, len, corrupt);
+	return len;
+}
+
+static void send_binary_end(size_t size) {
+	send_frame(BINARY_FRAME_END, size, NULL, 0, false);
+}
+
+/* How a file goes on the wire */
+struct encoding {
+	size_t (*unit)(const uint8_t *data, size_t size, uint32_t address,
+		       bool rewound, bool corrupt);
+	void (*end)(size_t size);
+	/* Data carried by a full record or frame */
+	size_t unit_size;
+};
+
+static const struct encoding hex_encoding = {
+	send_hex_unit, send_hex_end, HEX_RECORD_SIZE
+};
+static const struct encoding binary_encoding = {
+	send_binary_unit, send_binary_end, BINARY_FRAME_SIZE
+};
+
+/*
+ * @brief Sends the records of each group in reverse order
+ *
+ * Like the output of hex tools that sort by section instead of address.
+ * Every record carries its upper address, nothing is acked.
+ */
+static void send_hex_shuffled(const uint8_t *data, size_t size) {
+	uint32_t group = shuffle_records * HEX_RECORD_SIZE;
+	uint32_t base, address;
+	uint32_t unit = 0;
+
+	for (base = 0; base < size; base += group) {
+		address = base + group;
+		if (address > size)
+			address = size;
+		address = base + (address - base - 1) / HEX_RECORD_SIZE *
+			HEX_RECORD_SIZE;
+
+		for (;;) {
+			unit++;
+			send_hex_unit(data, size, address, true, unit == corrupt_unit);
+			if (address == base)
+				break;
+			address -= HEX_RECORD_SIZE;
+		}
+	}
+	send_hex_end(size);
+	corrupt_unit = 0;
+}
+
+/*
+ * @brief Sends every file after a file name record, then one end record
+ *
+ * The files are named after the last part of their path. A resumed upload
+ * skips the files before from_name, "" for the first one, and starts that
+ * one at address from.
+ */
+static void send_hex_files(struct script *script, char *paths,
+			   const char *from_name, uint32_t from) {
+	const char *name;
+	char *path, *data;
+	uint32_t address;
+	uint32_t unit = 0;
+	bool rewound = false;
+	size_t len;
+
+	for (path = strtok(paths, " "); path; path = strtok(NULL, " ")) {
+		name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+		address = 0;
+		if (from_name) {
+			if (from_name[0] && strcmp(name, from_name))
+				continue;
+			address = from;
+			rewound = true;
+			from_name = NULL;
+		}
+
+		unit++;
+		send_record(IHEX_FILE_NAME_RECORD, 0, (const uint8_t *)name,
+			strlen(name), unit == corrupt_unit);
+
+		data = read_file(script, path, &len);
+		while (address < len) {
+			unit++;
+			address += send_hex_unit((const uint8_t *)data, len, address,
+				rewound, unit == corrupt_unit);
+			rewound = false;
+		}
+		free(data);
+	}
+	if (from_name)
+		script_fail(script, "%s is not being sent", from_name);
+
+	send_hex_end(0);
+	corrupt_unit = 0;
+}
+
+/* Sends data starting at from, which is where a unit starts */
+static void send_data(struct script *script, const struct encoding *encoding,
+		      const uint8_t *data, size_t size, uint32_t from) {
+	uint32_t address = from;
+	uint32_t acked = from;
+	uint32_t unit = 0;
+	uint32_t before;
+	bool rewound = true;
+
+	script->ack_from = sim_cdc_tx_total();
+
+	for (;;) {
+		while (address < size) {
+			if (script->window && address - acked >= script->window) {
+				before = address;
+				wait_ack(script, &acked, &address);
+				rewound = address != before;
+				continue;
+			}
+
+			unit++;
+			if (unit == lose_unit) {
+				lose_unit = 0;
+				address += size - address < encoding->unit_size ?
+					size - address : encoding->unit_size;
+				rewound = true;
+				continue;
+			}
+
+			if (unit == repeat_unit) {
+				repeat_unit = 0;
+				encoding->unit(data, size, address, rewound, false);
+			}
+
+			address += encoding->unit(data, size, address, rewound,
+				unit == corrupt_unit);
+			if (unit == corrupt_unit)
+				corrupt_unit = 0;
+			rewound = false;
+		}
+
+		encoding->end(size);
+		if (!script->window)
+			break;
+
+		/* The last ack comes with the end of file, unless data is missing */
+		while (acked < size && address == size)
+			wait_ack(script, &acked, &address);
+		if (acked >= size)
+			break;
+		rewound = true;
+	}
+}
+
+/* Each key is sent on its own and the next one waits for the echo */
+static void type_keys(struct script *script, const char *text, size_t len) {
+	uint64_t start, elapsed, from;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		from = sim_cdc_tx_total();
+		start = sim_now_us();
+		sim_cdc_send(&text[i], 1);
+
+		if (!sim_cdc_wait_output(from, script->timeout_ms))
+			script_fail(script, "no echo for key %s", "");
+
+		elapsed = sim_now_us() - start;
+		keys.count++;
+		keys.total_us += elapsed;
+		if (elapsed > keys.max_us)
+			keys.max_us = elapsed;
+
+		sim_sleep_us((uint64_t)script->type_delay_ms * 1000);
+	}
+}
+
+/* Waits for "[RESEND] <address>" and returns the address */
+static uint32_t wait_resend(struct script *script, const char *path) {
+	uint64_t found, end;
+	char address[9] = { 0 };
+
+	found = sim_cdc_expect("[RESEND] ", script->expect_from,
+		script->timeout_ms);
+	end = found ? sim_cdc_expect("\r\n", found, script->timeout_ms) : 0;
+	if (!end || sim_cdc_output_read(found, address, 8) != 8)
+		script_fail(script, "no resend request for %s", path);
+	script->expect_from = end;
+	return strtoul(address, NULL, 16);
+}
+
+static void resume(struct script *script, const struct encoding *encoding,
+		   const char *path) {
+	uint32_t address = wait_resend(script, path);
+	char *data;
+	size_t len;
+
+	data = read_file(script, path, &len);
+	send_data(script, encoding, (const uint8_t *)data, len, address);
+	free(data);
+}
+
+/*
+ * @brief Answers a resend request of a hexfiles upload
+ *
+ * The address is relative to the file of the last "[FILE] <name>", or to
+ * the first file when the device has not announced one yet.
+ */
+static void resume_files(struct script *script, char *paths) {
+	uint32_t address = wait_resend(script, paths);
+	uint64_t len = script->expect_from - script->files_from;
+	char *out, *file, *end;
+	char *name = NULL;
+
+	out = malloc(len + 1);
+	if (out == NULL)
+		script_fail(script, "no memory for %s", paths);
+	len = sim_cdc_output_read(script->files_from, out, len);
+	out[len] = '\0';
+
+	for (file = out; (file = strstr(file, "[FILE] ")) != NULL; file++)
+		name = file + 7;
+	if (name && (end = strpbrk(name, "\r\n")) != NULL)
+		*end = '\0';
+
+	/* Where the rewound stream starts, see resume_name on the device */
+	send_record(IHEX_FILE_NAME_RECORD, 0, NULL, 0, false);
+	send_hex_files(script, paths, name ? name : "", address);
+	free(out);
+}
+
+static void drain(struct script *script) {
+	struct sim_cdc_stats stats;
+	uint64_t deadline = sim_now_us() + (uint64_t)script->timeout_ms * 1000;
+	uint64_t quiet_since = sim_now_us();
+	uint32_t processed = bytes_processed;
+	uint64_t sent = sim_cdc_tx_total();
+
+	while (sim_now_us() - quiet_since < DRAIN_QUIET_MS * 1000) {
+		if (sim_now_us() > deadline)
+			script_fail(script, "device did not settle%s", "");
+
+		sim_sleep_us(1000);
+		if (!sim_cdc_rx_idle() || processed != bytes_processed ||
+			sent != sim_cdc_tx_total()) {
+			processed = bytes_processed;
+			sent = sim_cdc_tx_total();
+			quiet_since = sim_now_us();
+		}
+	}
+
+	/* The application would have been called back from inside itself */
+	sim_cdc_stats_get(&stats);
+	if (stats.nested_irqs)
+		script_fail(script, "driver callback nested%s", "");
+}
+
+static void report(struct script *script, const char *label) {
+	struct sim_cdc_stats stats;
+	uint64_t elapsed = sim_now_us() - script->mark_us;
+	uint64_t bytes, written;
+
+	sim_cdc_stats_get(&stats);
+	bytes = stats.rx_bytes - script->mark_bytes;
+	written = sim_fs_written() - script->mark_written;
+	if (elapsed == 0)
+		elapsed = 1;
+
+	/* What ends up on the file is what the upload is worth */
+	fprintf(stderr, "%s: %llu bytes in %llu ms, %llu bytes/s, "
+		"%llu file bytes/s\n", label,
+		(unsigned long long)bytes, (unsigned long long)elapsed / 1000,
+		(unsigned long long)(bytes * 1000000 / elapsed),
+		(unsigned long long)(written * 1000000 / elapsed));
+}
+
+static void run_command(struct script *script, char *cmd, char *arg) {
+	struct sim_cdc_stats stats;
+	uint64_t found;
+	size_t len;
+	char *data;
+
+	if (!strcmp(cmd, "rate")) {
+		char *burst;
+		uint32_t rate = strtoul(arg, &burst, 0);
+
+		sim_cdc_set_rate(rate, strtoul(burst, NULL, 0));
+	} else if (!strcmp(cmd, "endpoint")) {
+		sim_cdc_set_endpoint(strtoul(arg, NULL, 0) != 0);
+	} else if (!strcmp(cmd, "send")) {
+		len = unescape(arg);
+		sim_cdc_send(arg, len);
+	} else if (!strcmp(cmd, "type")) {
+		len = unescape(arg);
+		type_keys(script, arg, len);
+	} else if (!strcmp(cmd, "typedelay")) {
+		script->type_delay_ms = strtoul(arg, NULL, 0);
+	} else if (!strcmp(cmd, "file")) {
+		data = read_file(script, arg, &len);
+		sim_cdc_send(data, len);
+		free(data);
+	} else if (!strcmp(cmd, "hexfile")) {
+		data = read_file(script, arg, &len);
+		if (shuffle_records)
+			send_hex_shuffled((const uint8_t *)data, len);
+		else
+			send_data(script, &hex_encoding, (const uint8_t *)data, len, 0);
+		free(data);
+	} else if (!strcmp(cmd, "hexfiles")) {
+		script->files_from = sim_cdc_tx_total();
+		send_hex_files(script, arg, NULL, 0);
+	} else if (!strcmp(cmd, "binfile")) {
+		data = read_file(script, arg, &len);
+		send_data(script, &binary_encoding, (const uint8_t *)data, len, 0);
+		free(data);
+	} else if (!strcmp(cmd, "window")) {
+		script->window = strtoul(arg, NULL, 0);
+	} else if (!strcmp(cmd, "corrupt")) {
+		corrupt_unit = strtoul(arg, NULL, 0);
+	} else if (!strcmp(cmd, "lose")) {
+		lose_unit = strtoul(arg, NULL, 0);
+	} else if (!strcmp(cmd, "repeat")) {
+		repeat_unit = strtoul(arg, NULL, 0);
+	} else if (!strcmp(cmd, "shuffle")) {
+		shuffle_records = strtoul(arg, NULL, 0);
+	} else if (!strcmp(cmd, "hexresume")) {
+		resume(script, &hex_encoding, arg);
+	} else if (!strcmp(cmd, "binresume")) {
+		resume(script, &binary_encoding, arg);
+	} else if (!strcmp(cmd, "hexfilesresume")) {
+		resume_files(script, arg);
+	} else if (!strcmp(cmd, "expect")) {
+		unescape(arg);
+		found = sim_cdc_expect(arg, script->expect_from, script->timeout_ms);
+		if (!found)
+			script_fail(script, "timed out waiting for \"%s\"", arg);
+		script->expect_from = found;
+	} else if (!strcmp(cmd, "timeout")) {
+		script->timeout_ms = strtoul(arg, NULL, 0);
+	} else if (!strcmp(cmd, "sleep")) {
+		sim_sleep_us(strtoull(arg, NULL, 0) * 1000);
+	} else if (!strcmp(cmd, "drain")) {
+		drain(script);
+	} else if (!strcmp(cmd, "mark")) {
+		sim_cdc_stats_get(&stats);
+		script->mark_us = sim_now_us();
+		script->mark_bytes = stats.rx_bytes;
+		script->mark_written = sim_fs_written();
+	} else if (!strcmp(cmd, "report")) {
+		report(script, arg[0] ? arg : "report");
+	} else if (!strcmp(cmd, "status") || !strcmp(cmd, "trace")) {
+		/* Shown even when the rest of the output is not */
+		if (script->out_fd < 0)
+			sim_cdc_set_output(STDERR_FILENO);
+		if (!strcmp(cmd, "status"))
+			uart_print_status();
+		else
+			trace_print();
+		acm_flush();
+		sim_cdc_set_output(script->out_fd);
+	} else {
+		script_fail(script, "unknown command %s", cmd);
+	}
+}
+
+static void run_script(struct script *script, FILE *file) {
+	char line[1024];
+	char *cmd, *arg, *end;
+
+	while (fgets(line, sizeof(line), file)) {
+		script->line++;
+
+		end = line + strlen(line);
+		while (end > line && (end[-1] == '\n' || end[-1] == '\r'))
+			*--end = '\0';
+
+		cmd = line;
+		while (*cmd == ' ' || *cmd == '\t')
+			cmd++;
+		if (*cmd == '\0' || *cmd == '#')
+			continue;
+
+		arg = cmd + strcspn(cmd, " \t");
+		if (*arg) {
+			*arg++ = '\0';
+			arg += strspn(arg, " \t");
+		}
+
+		run_command(script, cmd, arg);
+	}
+
+	drain(script);
+}
+
+/*************************** PTY ***************************************/
+
+static int pty_open(void) {
+	struct termios tio;
+	int master, slave;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		perror("pty");
+		exit(1);
+	}
+
+	/* Keep the slave open so the device survives terminals coming and going */
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		perror(ptsname(master));
+		exit(1);
+	}
+
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	fprintf(stderr, "Device on %s\n", ptsname(master));
+	return master;
+}
+
+static void *pty_reader(void *arg) {
+	int fd = *(int *)arg;
+	char buf[SIM_USB_MPS];
+	ssize_t len;
+
+	for (;;) {
+		len = read(fd, buf, sizeof(buf));
+		if (len > 0)
+			sim_cdc_send(buf, len);
+		else if (len < 0 && errno != EINTR && errno != EAGAIN)
+			sim_sleep_us(10000);
+	}
+	return NULL;
+}
+
+static void on_signal(int sig) {
+	ARG_UNUSED(sig);
+	stop = 1;
+}
+
+/*************************** MAIN **************************************/
+
+int main(int argc, char *argv[]) {
+	struct sim_cdc_config config = {
+		.rate = 0,
+		.burst = SIM_USB_MPS,
+		.tx_delay_us = 125,
+		.drop = false,
+	};
+	struct script script = {
+		.name = "<stdin>",
+		.timeout_ms = DEFAULT_TIMEOUT_MS,
+	};
+	const char *fs_root = "sim-fs";
+	bool use_pty = false;
+	bool quiet = false;
+	pthread_t thread;
+	FILE *file = stdin;
+	int out_fd, opt;
+
+	while ((opt = getopt(argc, argv, "r:b:t:df:pqvh")) != -1) {
+		switch (opt) {
+		case 'r':
+			config.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			config.burst = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			config.tx_delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			config.drop = true;
+			break;
+		case 'f':
+			fs_root = optarg;
+			break;
+		case 'p':
+			use_pty = true;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 'v':
+			sim_printk_enabled = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind < argc && strcmp(argv[optind], "-")) {
+		script.name = argv[optind];
+		file = fopen(script.name, "r");
+		if (file == NULL) {
+			perror(script.name);
+			return 1;
+		}
+	}
+
+	out_fd = quiet ? -1 : STDOUT_FILENO;
+	if (use_pty)
+		out_fd = pty_open();
+	script.out_fd = out_fd;
+
+	sim_stdout_init();
+	sim_fs_init(fs_root);
+	sim_cdc_start(&config, out_fd);
+
+	/* What main() and the mdef task list do on the board */
+	jerry_init(JERRY_INIT_EMPTY);
+	ashell_process_start();
+	pthread_create(&thread, NULL, acm_task, NULL);
+	sim_cdc_wait_ready();
+
+	if (use_pty) {
+		signal(SIGINT, on_signal);
+		signal(SIGTERM, on_signal);
+		pthread_create(&thread, NULL, pty_reader, &out_fd);
+		while (!stop)
+			pause();
+	} else {
+		run_script(&script, file);
+	}
+
+	print_stats();
+	return 0;
+}
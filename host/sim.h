@@ -0,0 +1,131 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Pieces shared by the host simulation modules
+ */
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Full speed bulk endpoints move 64 bytes per packet */
+#define SIM_USB_MPS 64
+
+/* Internal receive buffer of the CDC ACM driver */
+#ifndef SIM_CDC_BUFFER_SIZE
+#define SIM_CDC_BUFFER_SIZE 256
+#endif
+
+/*************************** KERNEL ************************************/
+
+extern bool sim_printk_enabled;
+
+uint64_t sim_now_us(void);
+void sim_sleep_us(uint64_t usec);
+
+/*
+ * @brief Routes printf() through the hook the uploader installs, the same
+ * way newlib does on the board. Until then output goes to stderr.
+ */
+void sim_stdout_init(void);
+
+/*************************** CDC ACM ***********************************/
+
+struct sim_cdc_config {
+	/* Host to device bytes per second, 0 sends as fast as allowed */
+	uint32_t rate;
+	/* Bytes sent back to back before pausing to keep the rate */
+	uint32_t burst;
+	/* Time it takes the host to collect one IN packet */
+	uint32_t tx_delay_us;
+	/* Behave like the stock driver and discard data when full */
+	bool drop;
+	/* Hold a packet that does not fit in the device and pull it in from
+	 * inside uart_fifo_read, instead of having the host retry it
+	 */
+	bool endpoint;
+};
+
+struct sim_cdc_stats {
+	uint64_t rx_bytes;
+	uint64_t rx_packets;
+	uint64_t rx_naks;
+	uint64_t rx_dropped;
+	uint64_t tx_bytes;
+	uint64_t tx_packets;
+	uint64_t irqs;
+	uint64_t nested_irqs;
+};
+
+void sim_cdc_start(const struct sim_cdc_config *config, int out_fd);
+void sim_cdc_set_rate(uint32_t rate, uint32_t burst);
+void sim_cdc_set_output(int out_fd);
+void sim_cdc_set_endpoint(bool endpoint);
+
+/* Blocks until the uploader has enabled the receive interrupt */
+void sim_cdc_wait_ready(void);
+
+/* Queues data on the host side, the USB thread delivers it */
+void sim_cdc_send(const void *buf, size_t len);
+
+/* True once everything queued has been read by the uploader */
+bool sim_cdc_rx_idle(void);
+
+/* Total bytes the device has sent to the host so far */
+uint64_t sim_cdc_tx_total(void);
+
+/*
+ * @brief Waits until the device output after @from contains @text
+ * @return Output offset right after the match, 0 on timeout
+ */
+uint64_t sim_cdc_expect(const char *text, uint64_t from, uint32_t timeout_ms);
+
+/*
+ * @brief Copies device output starting at @from
+ * @return Bytes copied, less than @len if the output is not there yet
+ */
+size_t sim_cdc_output_read(uint64_t from, char *buf, size_t len);
+
+/*
+ * @brief Waits for any device output past @from
+ * @return New output total, 0 on timeout
+ */
+uint64_t sim_cdc_wait_output(uint64_t from, uint32_t timeout_ms);
+
+void sim_cdc_stats_get(struct sim_cdc_stats *stats);
+
+/*************************** FILE SYSTEM *******************************/
+
+/* Files the uploader writes end up in this host directory */
+void sim_fs_init(const char *root);
+
+/* Bytes written to files so far, those in flash too */
+uint64_t sim_fs_written(void);
+
+/*************************** FLASH *************************************/
+
+/* The flash device when name is its name, erased on first use */
+struct device *sim_flash_binding(const char *name);
+
+/* Bytes written to the flash partition so far */
+uint64_t sim_flash_written(void);
+
+#endif
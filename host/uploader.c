@@ -0,0 +1,722 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Sends files to the uploader over a serial port
+ *
+ * Talks to the shell like a person would: sets the transfer mode, acks
+ * and compression, sends "load" and streams the files, as Intel HEX in a
+ * single session or as binary frames one file at a time. Resend requests
+ * are answered, a window of unacked data is kept in flight and if the
+ * device goes quiet the data is sent again from the last ack. Each file is
+ * read back with "crc -r" at the end and the upload repeated when one is
+ * wrong.
+ *
+ * Works with a board on /dev/ttyACM0 and with "outdir/ihex-sim -p".
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ihex/kk_ihex_read.h"
+#include "ihex-handler.h"
+#include "binary-handler.h"
+#include "code-memory.h"
+#include "lz-compress.h"
+
+#define MAX_FILES        16
+#define MAX_TIMEOUTS     5
+#define SETTLE_MS        200
+#define MAX_TRIES        3
+
+/* The shell prompt, it turns into "HEX> " in Intel HEX mode */
+static const char *prompts[] = { "acm> ", "HEX> ", NULL };
+
+struct file {
+	const char *path;
+	const char *name;
+	uint8_t *data;            /* What goes on the wire */
+	size_t size;
+	size_t file_size;         /* Size on the device */
+	uint32_t crc;             /* CRC-32 on the device */
+	uint32_t base;            /* Wire bytes of the files before it */
+};
+
+enum event {
+	EVENT_TIMEOUT,
+	EVENT_ACK,
+	EVENT_RESEND,
+	EVENT_FILE,
+	EVENT_EOF,
+	EVENT_CRC,
+};
+
+static struct {
+	int fd;
+	bool binary;
+	bool compress;
+	bool verify;
+	bool verbose;
+	uint32_t window;
+	uint32_t record_size;
+	uint32_t timeout_ms;
+	uint32_t tries;
+
+	/* Device output that has not been looked at */
+	char out[8192];
+	size_t out_len;
+
+	struct file files[MAX_FILES];
+	uint32_t count;
+
+	uint64_t wire_bytes;
+	uint32_t resends;
+	uint32_t timeouts;
+} up = {
+	.verify = true,
+	.window = 4096,
+	.record_size = 32,
+	.timeout_ms = 2000,
+	.tries = MAX_TRIES,
+};
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"Usage: %s [options] <device> <file>...\n"
+		"  -b           Binary frames instead of Intel HEX\n"
+		"  -z           Compress the files with LZ\n"
+		"  -w <bytes>   Data in flight without an ack, 0 turns acks off\n"
+		"               (default 4096)\n"
+		"  -s <bytes>   Data bytes per Intel HEX record (default 32)\n"
+		"  -t <ms>      How long the device may stay quiet (default 2000)\n"
+		"  -n           Do not check the files with crc afterwards\n"
+		"  -r <tries>   Uploads before giving up on a bad crc (default 3)\n"
+		"  -v           Copy the device output to stderr\n"
+		"Files are stored under their name without the path.\n", name);
+}
+
+static void fail(const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Same CRC-32 the device uses for frames and for "crc" */
+static uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len) {
+	int bit;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *buf++;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320U & -(crc & 1));
+	}
+	return ~crc;
+}
+
+/*************************** SERIAL ************************************/
+
+static void serial_open(const char *path) {
+	struct termios tio;
+
+	up.fd = open(path, O_RDWR | O_NOCTTY);
+	if (up.fd < 0)
+		fail("%s: %s", path, strerror(errno));
+
+	/* Raw, but the device may still stop the host with XOFF */
+	if (tcgetattr(up.fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tio.c_iflag |= IXON;
+		cfsetispeed(&tio, B115200);
+		cfsetospeed(&tio, B115200);
+		tcsetattr(up.fd, TCSANOW, &tio);
+	}
+	tcflush(up.fd, TCIOFLUSH);
+}
+
+static void serial_write(const void *buf, size_t len) {
+	const uint8_t *data = buf;
+	ssize_t done;
+
+	while (len > 0) {
+		done = write(up.fd, data, len);
+		if (done < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			fail("write: %s", strerror(errno));
+		}
+		data += done;
+		len -= done;
+		up.wire_bytes += done;
+	}
+}
+
+/* Waits up to timeout_ms for more device output */
+static bool serial_read(uint32_t timeout_ms) {
+	struct pollfd pfd = { .fd = up.fd, .events = POLLIN };
+	ssize_t len;
+
+	if (up.out_len == sizeof(up.out)) {
+		/* Nobody asked for it, keep the newer half */
+		memmove(up.out, up.out + sizeof(up.out) / 2, sizeof(up.out) / 2);
+		up.out_len = sizeof(up.out) / 2;
+	}
+
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return false;
+
+	len = read(up.fd, up.out + up.out_len, sizeof(up.out) - up.out_len);
+	if (len <= 0)
+		return false;
+
+	if (up.verbose)
+		fwrite(up.out + up.out_len, 1, len, stderr);
+	up.out_len += len;
+	return true;
+}
+
+static void serial_consume(size_t len) {
+	memmove(up.out, up.out + len, up.out_len - len);
+	up.out_len -= len;
+}
+
+/* Waits for one of the texts and drops everything up to its end */
+static void expect_any(const char **texts) {
+	const char **text;
+	char *found;
+
+	for (;;) {
+		for (text = texts; *text; text++) {
+			found = memmem(up.out, up.out_len, *text, strlen(*text));
+			if (found) {
+				serial_consume(found - up.out + strlen(*text));
+				return;
+			}
+		}
+		if (!serial_read(up.timeout_ms))
+			fail("No \"%s\" from the device", texts[0]);
+	}
+}
+
+static void expect(const char *text) {
+	const char *texts[] = { text, NULL };
+
+	expect_any(texts);
+}
+
+/* Runs a shell command and waits for the prompt after it */
+static void command(const char *fmt, ...) {
+	char line[64];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(line, sizeof(line) - 1, fmt, args);
+	va_end(args);
+
+	line[len++] = '\r';
+	serial_write(line, len);
+	expect_any(prompts);
+}
+
+/*
+ * @brief Returns the next line of interest from the device
+ *
+ * Lines are "[ACK] <bytes>", "[RESEND] <address>", "[FILE] <name>",
+ * "[EOF]" and "[CRC] <crc> <size>". Errors end the upload, holes and
+ * overlaps are only shown.
+ */
+static enum event next_event(uint32_t *value, uint32_t *extra, char *text) {
+	char line[128];
+	char *end;
+	size_t len, t, n;
+
+	for (;;) {
+		while ((end = memchr(up.out, '\n', up.out_len)) != NULL) {
+			len = end - up.out;
+			for (t = 0, n = 0; t < len && n < sizeof(line) - 1; t++) {
+				if (up.out[t] != '\0' && up.out[t] != '\r')
+					line[n++] = up.out[t];
+			}
+			line[n] = '\0';
+			serial_consume(len + 1);
+
+			if ((end = strstr(line, "[ACK] ")) != NULL) {
+				*value = strtoul(end + 6, NULL, 10);
+				return EVENT_ACK;
+			} else if ((end = strstr(line, "[RESEND] ")) != NULL) {
+				*value = strtoul(end + 9, NULL, 16);
+				return EVENT_RESEND;
+			} else if ((end = strstr(line, "[FILE] ")) != NULL) {
+				snprintf(text, MAX_FILENAME_SIZE, "%s", end + 7);
+				return EVENT_FILE;
+			} else if (strstr(line, "[EOF]")) {
+				return EVENT_EOF;
+			} else if ((end = strstr(line, "[CRC] ")) != NULL) {
+				*value = strtoul(end + 6, &end, 16);
+				*extra = strtoul(end, NULL, 10);
+				return EVENT_CRC;
+			} else if ((end = strstr(line, "[ERR]")) != NULL) {
+				fail("Device: %s", end);
+			} else if ((end = strstr(line, "[HOLE]")) != NULL ||
+				(end = strstr(line, "[OVERLAP]")) != NULL) {
+				fprintf(stderr, "Device: %s\n", end);
+			}
+		}
+
+		if (!serial_read(up.timeout_ms))
+			return EVENT_TIMEOUT;
+	}
+}
+
+/*************************** ENCODING **********************************/
+
+static void send_record(uint8_t type, uint16_t address, const uint8_t *data,
+			uint8_t len) {
+	char line[16 + 2 * 255];
+	uint8_t sum = len + (address >> 8) + (address & 0xFF) + type;
+	int pos, i;
+
+	pos = sprintf(line, ":%02X%04X%02X", len, address, type);
+	for (i = 0; i < len; i++) {
+		pos += sprintf(line + pos, "%02X", data[i]);
+		sum += data[i];
+	}
+	pos += sprintf(line + pos, "%02X\r\n", (uint8_t)-sum);
+	serial_write(line, pos);
+}
+
+static void send_hex_name(const struct file *file) {
+	send_record(IHEX_FILE_NAME_RECORD, 0, (const uint8_t *)file->name,
+		strlen(file->name));
+}
+
+/*
+ * An empty name record tells the device where the data sent again starts,
+ * the records before it were in flight. The file gets named again next.
+ */
+static void send_hex_rewind(void) {
+	send_record(IHEX_FILE_NAME_RECORD, 0, NULL, 0);
+}
+
+/* One record of file at address, returns the bytes it carried */
+static size_t send_hex_unit(const struct file *file, uint32_t address,
+			    bool rewound) {
+	uint8_t upper[2];
+	size_t len;
+
+	if (address > 0 && ((address & 0xFFFF) == 0 || rewound)) {
+		upper[0] = address >> 24;
+		upper[1] = address >> 16;
+		send_record(IHEX_EXTENDED_LINEAR_ADDRESS_RECORD, 0, upper, 2);
+	}
+
+	/* Records do not cross into the next 64 KB */
+	len = file->size - address;
+	if (len > up.record_size)
+		len = up.record_size;
+	if (len > 0x10000 - (address & 0xFFFF))
+		len = 0x10000 - (address & 0xFFFF);
+
+	send_record(IHEX_DATA_RECORD, address & 0xFFFF, file->data + address, len);
+	return len;
+}
+
+static void send_frame(uint8_t type, uint32_t offset, const uint8_t *data,
+		       uint16_t len) {
+	uint8_t header[BINARY_HEADER_SIZE];
+	uint8_t crc[BINARY_CRC_SIZE];
+	uint32_t value;
+	int i;
+
+	header[0] = BINARY_SYNC;
+	header[1] = type;
+	header[2] = len;
+	header[3] = len >> 8;
+	for (i = 0; i < 4; i++)
+		header[4 + i] = offset >> (8 * i);
+	value = crc32(0, header, 8);
+	for (i = 0; i < 4; i++)
+		header[8 + i] = value >> (8 * i);
+
+	value = crc32(0, data, len);
+	for (i = 0; i < 4; i++)
+		crc[i] = value >> (8 * i);
+
+	serial_write(header, sizeof(header));
+	serial_write(data, len);
+	serial_write(crc, sizeof(crc));
+}
+
+static size_t send_binary_unit(const struct file *file, uint32_t address) {
+	size_t len = file->size - address;
+
+	if (len > BINARY_LZ_MAX_PAYLOAD)
+		len = BINARY_LZ_MAX_PAYLOAD;
+
+	send_frame(BINARY_FRAME_DATA, address, file->data + address, len);
+	return len;
+}
+
+/*************************** UPLOAD ************************************/
+
+static uint32_t file_index(const char *name, uint32_t first, uint32_t last) {
+	uint32_t t;
+
+	for (t = first; t < last; t++) {
+		if (!strcmp(up.files[t].name, name))
+			return t;
+	}
+	fail("Device opened %s, which is not being sent", name);
+	return 0;
+}
+
+/*
+ * @brief Streams files first to last - 1 in one "load"
+ *
+ * Positions are counted in wire data bytes from the start of the session,
+ * as the device counts them in its acks.
+ */
+static void upload(uint32_t first, uint32_t last) {
+	const struct file *file;
+	char text[MAX_FILENAME_SIZE];
+	uint32_t current = first;     /* File the device writes */
+	uint32_t index = first;       /* File being sent */
+	uint32_t address = 0;
+	uint32_t acked = 0;
+	uint32_t value, extra;
+	uint32_t timeouts = 0;
+	uint32_t base = up.files[first].base;
+	uint32_t end = up.files[last - 1].base + up.files[last - 1].size;
+	bool rewound = false;
+	bool name = !up.binary;
+	bool sent_end = false;
+	enum event event;
+
+	for (;;) {
+		while (index < last) {
+			file = &up.files[index];
+			/* Duplicates are acked too, acked may be ahead */
+			if (up.window &&
+			    file->base + address - base >= acked + up.window)
+				break;
+
+			/* Sent even for empty files, so they get created */
+			if (name) {
+				send_hex_name(file);
+				name = false;
+			}
+
+			if (address == file->size) {
+				index++;
+				address = 0;
+				name = !up.binary;
+				continue;
+			}
+
+			if (up.binary)
+				address += send_binary_unit(file, address);
+			else
+				address += send_hex_unit(file, address, rewound);
+			rewound = false;
+		}
+
+		if (index == last && !sent_end) {
+			if (up.binary)
+				send_frame(BINARY_FRAME_END, up.files[first].size, NULL, 0);
+			else
+				send_record(IHEX_END_OF_FILE_RECORD, 0, NULL, 0);
+			sent_end = true;
+		}
+
+		event = next_event(&value, &extra, text);
+		switch (event) {
+		case EVENT_ACK:
+			acked = value;
+			timeouts = 0;
+			break;
+		case EVENT_FILE:
+			current = file_index(text, first, last);
+			break;
+		case EVENT_EOF:
+			return;
+		case EVENT_RESEND:
+			/* Relative to the file the device announced last */
+			up.resends++;
+			index = current;
+			address = value;
+			rewound = true;
+			name = !up.binary;
+			sent_end = false;
+			if (name)
+				send_hex_rewind();
+			if (address > up.files[index].size)
+				fail("Resend from %u is past the end of %s",
+					(unsigned int)value, up.files[index].name);
+			break;
+		case EVENT_TIMEOUT:
+			if (++timeouts > MAX_TIMEOUTS)
+				fail("The device stopped answering");
+
+			/* Something got lost, send again from the last ack */
+			up.timeouts++;
+			index = current;
+			address = 0;
+			if (base + acked > up.files[index].base)
+				address = base + acked - up.files[index].base;
+			if (address > up.files[index].size)
+				address = up.files[index].size;
+			rewound = true;
+			name = !up.binary;
+			if (name)
+				send_hex_rewind();
+			sent_end = false;
+			break;
+		default:
+			break;
+		}
+
+		if (acked > end - base)
+			acked = end - base;
+	}
+}
+
+/*
+ * @brief Waits until the device is quiet and back at the prompt
+ *
+ * Data that was still in flight when the upload finished ends up in the
+ * shell, the line end closes whatever it left on the command line.
+ */
+static void settle(void) {
+	while (serial_read(SETTLE_MS))
+		;
+	up.out_len = 0;
+	serial_write("\r", 1);
+	expect_any(prompts);
+}
+
+/* Asks the device for the CRC of every file */
+static bool verify(void) {
+	const struct file *file;
+	uint32_t crc, size, t;
+	char text[MAX_FILENAME_SIZE];
+	enum event event;
+	bool ok = true;
+
+	for (t = 0; t < up.count; t++) {
+		file = &up.files[t];
+		serial_write("crc -r ", 7);
+		serial_write(file->name, strlen(file->name));
+		serial_write("\r", 1);
+
+		do {
+			event = next_event(&crc, &size, text);
+		} while (event != EVENT_CRC && event != EVENT_TIMEOUT);
+
+		if (event == EVENT_TIMEOUT) {
+			fprintf(stderr, "%s: no crc from the device\n", file->name);
+			ok = false;
+			continue;
+		}
+		expect_any(prompts);
+
+		if (crc != file->crc || size != file->file_size) {
+			fprintf(stderr, "%s: device has %08X %u, expected %08X %u\n",
+				file->name, (unsigned int)crc, (unsigned int)size,
+				(unsigned int)file->crc, (unsigned int)file->file_size);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/* One upload of all the files */
+static void transfer(void) {
+	uint32_t t;
+
+	if (up.binary) {
+		/* The binary transfer has no file names, one load each */
+		for (t = 0; t < up.count; t++) {
+			command("set filename %s", up.files[t].name);
+			up.files[t].base = 0;
+			serial_write("load\r", 5);
+			expect("[READY]");
+			upload(t, t + 1);
+			expect_any(prompts);
+		}
+	} else {
+		serial_write("load\r", 5);
+		expect("[READY]");
+		upload(0, up.count);
+		expect_any(prompts);
+	}
+}
+
+static void load_file(struct file *file, const char *path) {
+	FILE *in = fopen(path, "rb");
+	uint8_t *data, *packed;
+	long size;
+
+	if (in == NULL)
+		fail("%s: %s", path, strerror(errno));
+	fseek(in, 0, SEEK_END);
+	size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+
+	data = malloc(size + 1);
+	if (data == NULL || fread(data, 1, size, in) != (size_t)size)
+		fail("%s: cannot read", path);
+	fclose(in);
+
+	file->path = path;
+	file->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	if (strlen(file->name) >= MAX_FILENAME_SIZE)
+		fail("%s: names are at most %d characters on the device",
+			file->name, MAX_FILENAME_SIZE - 1);
+
+	file->file_size = size;
+	file->crc = crc32(0, data, size);
+	file->data = data;
+	file->size = size;
+
+	if (up.compress) {
+		packed = malloc(LZ_COMPRESS_BOUND(size));
+		file->size = lz_compress(data, size, packed);
+		file->data = packed;
+		free(data);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t start, elapsed;
+	uint64_t file_bytes = 0;
+	uint32_t t, base = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bzw:s:t:nr:vh")) != -1) {
+		switch (opt) {
+		case 'b':
+			up.binary = true;
+			break;
+		case 'z':
+			up.compress = true;
+			break;
+		case 'w':
+			up.window = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			up.record_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			up.timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			up.verify = false;
+			break;
+		case 'r':
+			up.tries = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			up.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (argc - optind < 2 || argc - optind - 1 > MAX_FILES) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (up.record_size == 0 || up.record_size > IHEX_LINE_MAX_LENGTH)
+		fail("Records carry 1 to %d bytes", IHEX_LINE_MAX_LENGTH);
+
+	for (t = optind + 1; t < argc; t++) {
+		load_file(&up.files[up.count], argv[t]);
+		up.files[up.count].base = base;
+		base += up.files[up.count].size;
+		file_bytes += up.files[up.count].file_size;
+		up.count++;
+	}
+
+	serial_open(argv[optind]);
+
+	/* Whatever was on the line before, then a fresh prompt */
+	serial_write("\r", 1);
+	expect_any(prompts);
+	command("set transfer %s", up.binary ? "binary" : "ihex");
+	command("set compress %s", up.compress ? "lz" : "off");
+	if (up.window)
+		command("set ack bytes %u", (unsigned int)(up.window / 4));
+	else
+		command("set ack off");
+
+	for (t = 1; ; t++) {
+		up.wire_bytes = 0;
+		start = now_us();
+		transfer();
+		elapsed = now_us() - start;
+		if (elapsed == 0)
+			elapsed = 1;
+
+		fprintf(stderr, "%u files, %llu bytes in %llu ms, %llu bytes/s, "
+			"%llu file bytes/s, %u resends, %u timeouts\n",
+			(unsigned int)up.count, (unsigned long long)up.wire_bytes,
+			(unsigned long long)elapsed / 1000,
+			(unsigned long long)(up.wire_bytes * 1000000 / elapsed),
+			(unsigned long long)(file_bytes * 1000000 / elapsed),
+			(unsigned int)up.resends, (unsigned int)up.timeouts);
+
+		if (!up.verify)
+			break;
+		settle();
+		if (verify()) {
+			fprintf(stderr, "Verified\n");
+			break;
+		}
+		if (t >= up.tries)
+			return 1;
+		fprintf(stderr, "Uploading again\n");
+	}
+
+	close(up.fd);
+	return 0;
+}
@@ -325,13 +325,15 @@ void ashell_process_line(const char *buf, uint32_t len) {
 	acm_print(acm_get_prompt());
 }
 
-uint32_t ashell_process_data(const char *buf, uint32_t len) {
+uint32_t ashell_process_data(const struct uploader_span *span) {
+	const char *buf = span->buf;
+	uint32_t len = span->len;
 	uint32_t processed = 0;
 	bool flush_line = false;
 
 	if (shell_line == NULL) {
 		DBG("[Proccess]%d\n", (int)len);
-		DBG("[%s]\n", buf);
+		DBG("[%.*s]\n", (int)len, buf);
 		shell_line = (char *)malloc(MAX_LINE);
 		memset(shell_line, 0, MAX_LINE);
 		tail = 0;
@@ -400,7 +402,7 @@ uint32_t ashell_process_data(const char *buf, uint32_t len) {
 		if (flush_line) {
 			DBG("Line %u %u \n", cur, end);
 			shell_line[cur + end] = '\0';
-			acm_write("\r\n", 3);
+			acm_write("\r\n", 2);
 
 			uint32_t length = strlen(shell_line);
 			int32_t ret = 0;
@@ -437,6 +439,9 @@ uint32_t ashell_process_data(const char *buf, uint32_t len) {
 	return processed;
 }
 
+/* Takes over when the shell closes, the IHEX uploader unless told otherwise */
+static ashell_process_start_t next_process_start = ihex_process_start;
+
 bool ashell_process_is_done() {
 	if (ashell_is_done) {
 		printf("[Done]\n");
@@ -446,7 +451,7 @@ bool ashell_process_is_done() {
 
 uint32_t ashell_process_finish() {
 	printf("[SHELL CLOSE]\n");
-	ihex_process_start();
+	next_process_start();
 	return 0;
 }
 
@@ -464,10 +469,15 @@ void ashell_register_app_line_handler(ashell_line_parser_t cb) {
 	app_line_cb = cb;
 }
 
-void ashell_process_close() {
+void ashell_process_switch(ashell_process_start_t start) {
+	next_process_start = start;
 	ashell_is_done = true;
 }
 
+void ashell_process_close() {
+	ashell_process_switch(ihex_process_start);
+}
+
 void ashell_process_start() {
 	struct uploader_cfg_data cfg;
 
@@ -478,6 +488,9 @@ void ashell_process_start() {
 	cfg.interface.is_done = ashell_process_is_done;
 	cfg.interface.close_cb = ashell_process_finish;
 	cfg.interface.process_cb = ashell_process_data;
+	cfg.interface.flush_policy = &uploader_flush_interactive;
+	cfg.interface.chunk_size = MAX_LINE;
+	cfg.interface.progress_cb = NULL;
 	cfg.print_state = ashell_print_status;
 
 	process_set_config(&cfg);
@@ -28,8 +28,14 @@ const char *acm_get_prompt();
  */
 typedef int32_t(*ashell_line_parser_t)(const char *buf, uint32_t len);
 
+/**
+ * Starts the process that takes over the data when the shell closes
+ */
+typedef void(*ashell_process_start_t)();
+
 void ashell_process_start();
 void ashell_process_close();
+void ashell_process_switch(ashell_process_start_t start);
 
 void ashell_register_app_line_handler(ashell_line_parser_t cb);
 
@@ -0,0 +1,455 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+* @file
+* @brief Binary transfer handler
+*
+* Reads length prefixed, CRC checked frames from the uart and writes the
+* payload straight to the file as it arrives, with no text encoding on
+* the wire. Suited for JerryScript snapshots or any other binary.
+*/
+
+#include <nanokernel.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "code-memory.h"
+#include "uart-uploader.h"
+#include "acm-shell.h"
+#include "shell-state.h"
+#include "binary-handler.h"
+#include "uploader-trace.h"
+#include "lz-stream.h"
+#include "uploader-log.h"
+
+/* Frames are not tied to lines, take the data in large chunks */
+#define BINARY_CHUNK_SIZE 512
+
+/* Gives up after that many bad frames */
+#define BINARY_MAX_RESYNCS 16
+
+static CODE *code_memory = NULL;
+
+static int8_t upload_state = 0;
+#define UPLOAD_START       0
+#define UPLOAD_IN_PROGRESS 1
+#define UPLOAD_FINISHED    2
+#define UPLOAD_RESYNC      3
+#define UPLOAD_ERROR       -1
+
+/* Part of the frame the next byte belongs to */
+static enum {
+	FRAME_HEADER,
+	FRAME_PAYLOAD,
+	FRAME_CRC
+} frame_state;
+
+static uint8_t frame_header[BINARY_HEADER_SIZE];
+static uint8_t frame_crc[BINARY_CRC_SIZE];
+static uint32_t frame_fill;
+
+static uint8_t frame_type;
+static uint32_t frame_length;
+static uint32_t frame_offset;
+static uint32_t payload_left;
+static uint32_t payload_crc;
+
+/* The payload of this frame goes to the file, dropped otherwise */
+static bool frame_accepted;
+
+/* File position after the last write, to save seeks */
+static uint32_t write_offset;
+
+/* End of the last frame that was accepted */
+static uint32_t resume_offset;
+
+/* The frames carry LZ data, inflated on the way to the file */
+static bool compressed;
+
+/*
+ * Payloads go to the file only once their CRC is good, so the whole
+ * payload has to be in one span and payloads are limited to
+ * BINARY_LZ_MAX_PAYLOAD. Needed for LZ data, which can not be inflated
+ * twice, and for flash files, which can not seek back over a bad frame.
+ * Frames have to come in order then.
+ */
+static bool in_order;
+
+static uint32_t accepted_frames;
+static uint32_t accepted_bytes;
+static uint32_t dropped_frames;
+static uint32_t bad_frames;
+static uint32_t skipped_bytes;
+static uint32_t resyncs;
+
+static const uint32_t crc32_nibble[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t binary_crc32(uint32_t crc, const void *buf, size_t len) {
+	const uint8_t *data = (const uint8_t *)buf;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+	}
+	return ~crc;
+}
+
+static uint32_t get_le32(const uint8_t *buf) {
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+/*
+ * @brief Asks the host to send everything again from offset
+ *
+ * Frames are dropped until one starts at offset, the file stays open.
+ */
+static void binary_resend(uint32_t offset) {
+	char line[24];
+
+	if (++resyncs > BINARY_MAX_RESYNCS) {
+		upload_state = UPLOAD_ERROR;
+		acm_println("[ERR] Frame error");
+		return;
+	}
+
+	upload_state = UPLOAD_RESYNC;
+	resume_offset = offset;
+	snprintf(line, sizeof(line), "[RESEND] %08X", (unsigned int)offset);
+	acm_println(line);
+}
+
+/* Checks a complete header and decides what to do with the frame */
+static void binary_header_done(void) {
+	uint8_t *sync;
+
+	if (binary_crc32(0, frame_header, 8) != get_le32(frame_header + 8) ||
+		frame_header[1] < BINARY_FRAME_DATA ||
+		frame_header[1] > BINARY_FRAME_END) {
+		/* Not a header, look for the next sync byte in what we have */
+		sync = memchr(frame_header + 1, BINARY_SYNC, BINARY_HEADER_SIZE - 1);
+		frame_fill = sync ? BINARY_HEADER_SIZE - (sync - frame_header) : 0;
+		skipped_bytes += BINARY_HEADER_SIZE - frame_fill;
+		memmove(frame_header, frame_header + BINARY_HEADER_SIZE - frame_fill,
+			frame_fill);
+
+		/* Once the host was asked, frames it sent before are no news */
+		bad_frames++;
+		if (upload_state != UPLOAD_RESYNC)
+			binary_resend(resume_offset);
+		return;
+	}
+
+	frame_type = frame_header[1];
+	frame_length = frame_header[2] | (frame_header[3] << 8);
+	frame_offset = get_le32(frame_header + 4);
+	frame_fill = 0;
+
+	/* Other frames may repeat what we have when the host rewinds, but a
+	 * frame past the resume offset means the ones in between were lost
+	 * whole.
+	 */
+	frame_accepted = (upload_state != UPLOAD_RESYNC && !in_order &&
+		frame_offset <= resume_offset) || frame_offset == resume_offset;
+
+	if (frame_type != BINARY_FRAME_END && frame_offset > resume_offset &&
+		upload_state != UPLOAD_RESYNC) {
+		dropped_frames++;
+		binary_resend(resume_offset);
+	}
+
+	/* Only the CRC of the empty payload follows, so it is not left over */
+	if (frame_type == BINARY_FRAME_END) {
+		frame_state = FRAME_CRC;
+		return;
+	}
+
+	payload_left = frame_length;
+	payload_crc = 0;
+	frame_state = (frame_length > 0) ? FRAME_PAYLOAD : FRAME_CRC;
+
+	if (frame_accepted && !in_order && frame_offset != write_offset) {
+		if (csseek(code_memory, frame_offset, SEEK_SET)) {
+			upload_state = UPLOAD_ERROR;
+			return;
+		}
+		write_offset = frame_offset;
+	}
+}
+
+/* The header was good, finish the upload unless data is missing */
+static void binary_end_done(void) {
+	/* The offset of the end is the file size, a frame that was lost with
+	 * its header left nothing else behind.
+	 */
+	if (!frame_accepted || frame_offset != resume_offset) {
+		/* The host is done but we are missing data, ask again */
+		dropped_frames++;
+		binary_resend(resume_offset);
+		return;
+	}
+
+	if (compressed && !lz_stream_finish(&upload_lz)) {
+		acm_println("[ERR] Bad compressed data");
+		upload_state = UPLOAD_ERROR;
+		return;
+	}
+
+	/* The last sector is still in the cache of the handle */
+	if (csflush(code_memory)) {
+		LOG_ERR("Failed writting into file\n");
+		upload_state = UPLOAD_ERROR;
+		return;
+	}
+
+	acm_println("[EOF]");
+	upload_state = UPLOAD_FINISHED;
+}
+
+/*
+ * @brief Checks the payload CRC of a complete frame
+ *
+ * @param payload The whole payload for frames that come in order, NULL if
+ * it was written while it arrived
+ */
+static void binary_frame_done(const uint8_t *payload) {
+	frame_state = FRAME_HEADER;
+	frame_fill = 0;
+
+	if (frame_type == BINARY_FRAME_END) {
+		binary_end_done();
+		return;
+	}
+
+	if (!frame_accepted) {
+		dropped_frames++;
+		return;
+	}
+
+	if (payload_crc != get_le32(frame_crc)) {
+		trace_add(TRACE_CHECKSUM, frame_type, frame_offset);
+		bad_frames++;
+		binary_resend(frame_offset);
+		return;
+	}
+
+	if (payload && compressed &&
+		!lz_stream_feed(&upload_lz, payload, frame_length)) {
+		acm_println("[ERR] Bad compressed data");
+		upload_state = UPLOAD_ERROR;
+		return;
+	}
+
+	if (payload && !compressed) {
+		if (cswrite((const char *)payload, frame_length, 1, code_memory) !=
+			frame_length) {
+			LOG_ERR("Failed writting into file\n");
+			upload_state = UPLOAD_ERROR;
+			return;
+		}
+		write_offset += frame_length;
+	}
+
+	upload_state = UPLOAD_IN_PROGRESS;
+	if (frame_offset + frame_length > resume_offset)
+		resume_offset = frame_offset + frame_length;
+	accepted_frames++;
+	accepted_bytes += frame_length;
+}
+
+/* Writes a piece of the payload as soon as it arrives */
+static void binary_payload(const uint8_t *buf, uint32_t len) {
+	if (!frame_accepted)
+		return;
+
+	payload_crc = binary_crc32(payload_crc, buf, len);
+	if (cswrite((const char *)buf, len, 1, code_memory) != len) {
+		LOG_ERR("Failed writting into file\n");
+		upload_state = UPLOAD_ERROR;
+		return;
+	}
+	write_offset += len;
+}
+
+/*
+ * @brief Takes a payload that comes in order and its CRC in one go
+ * @return Bytes used, 0 to wait until the rest of the frame is there
+ */
+static uint32_t binary_payload_whole(const uint8_t *buf, uint32_t len) {
+	if (frame_length > BINARY_LZ_MAX_PAYLOAD) {
+		acm_println("[ERR] Frame too large");
+		upload_state = UPLOAD_ERROR;
+		return 0;
+	}
+
+	if (len < frame_length + BINARY_CRC_SIZE)
+		return 0;
+
+	if (frame_accepted)
+		payload_crc = binary_crc32(0, buf, frame_length);
+	memcpy(frame_crc, buf + frame_length, BINARY_CRC_SIZE);
+	binary_frame_done(buf);
+	return frame_length + BINARY_CRC_SIZE;
+}
+
+static bool binary_lz_sink(const char *buf, uint32_t len) {
+	return cswrite(buf, len, 1, code_memory) == len;
+}
+
+/**************************** DEVICE **********************************/
+
+uint32_t binary_process_init() {
+	upload_state = UPLOAD_START;
+	acm_println("[READY]");
+
+	frame_state = FRAME_HEADER;
+	frame_fill = 0;
+	write_offset = 0;
+	resume_offset = 0;
+	accepted_frames = 0;
+	accepted_bytes = 0;
+	dropped_frames = 0;
+	bad_frames = 0;
+	skipped_bytes = 0;
+	resyncs = 0;
+	compressed = lz_stream_enabled();
+	if (compressed)
+		lz_stream_init(&upload_lz, binary_lz_sink);
+	in_order = compressed ||
+		code_memory_get_storage() == CODE_STORAGE_FLASH;
+	code_memory = csopen(ashell_get_filename(), "w+");
+
+	if (!code_memory)
+		upload_state = UPLOAD_ERROR;
+
+	return (!code_memory);
+}
+
+bool binary_process_is_done() {
+	return (upload_state == UPLOAD_FINISHED || upload_state == UPLOAD_ERROR);
+}
+
+void binary_process_progress(uint32_t *frames, uint32_t *bytes) {
+	*frames = accepted_frames;
+	*bytes = accepted_bytes;
+}
+
+uint32_t binary_process_data(const struct uploader_span *span) {
+	const uint8_t *buf = (const uint8_t *)span->buf;
+	const uint8_t *end = buf + span->len;
+	uint32_t len;
+
+	while (buf < end && !binary_process_is_done()) {
+		switch (frame_state) {
+		case FRAME_HEADER:
+			if (frame_fill == 0 && *buf != BINARY_SYNC) {
+				skipped_bytes++;
+				buf++;
+				continue;
+			}
+
+			len = BINARY_HEADER_SIZE - frame_fill;
+			if (len > (uint32_t)(end - buf))
+				len = end - buf;
+			memcpy(frame_header + frame_fill, buf, len);
+			frame_fill += len;
+			buf += len;
+
+			if (frame_fill == BINARY_HEADER_SIZE)
+				binary_header_done();
+			break;
+
+		case FRAME_PAYLOAD:
+			if (in_order) {
+				len = binary_payload_whole(buf, end - buf);
+				if (len == 0)
+					goto hand_back;
+				buf += len;
+				break;
+			}
+
+			len = payload_left;
+			if (len > (uint32_t)(end - buf))
+				len = end - buf;
+			binary_payload(buf, len);
+			payload_left -= len;
+			buf += len;
+
+			if (payload_left == 0)
+				frame_state = FRAME_CRC;
+			break;
+
+		case FRAME_CRC:
+			frame_crc[frame_fill++] = *buf++;
+			if (frame_fill == BINARY_CRC_SIZE)
+				binary_frame_done(NULL);
+			break;
+		}
+	}
+
+hand_back:
+	return buf - (const uint8_t *)span->buf;
+}
+
+uint32_t binary_process_finish() {
+	if (code_memory != NULL) {
+		csclose(code_memory);
+		code_memory = NULL;
+	}
+
+	if (upload_state != UPLOAD_FINISHED)
+		printf("[Error] Binary upload failed \n");
+
+	ashell_process_start();
+	return (upload_state != UPLOAD_FINISHED);
+}
+
+void binary_print_status() {
+	printf("[Binary] State %d Frames %d Bytes %d Dropped %d Bad %d Skipped %d\n",
+		(int)upload_state, (int)accepted_frames, (int)accepted_bytes,
+		(int)dropped_frames, (int)bad_frames, (int)skipped_bytes);
+	printf("[Resync] %d Resume %d%s\n", (int)resyncs, (int)resume_offset,
+		(upload_state == UPLOAD_RESYNC) ? " Waiting" : "");
+	if (compressed)
+		printf("[LZ] In %d Out %d\n", (int)accepted_bytes,
+			(int)upload_lz.produced);
+}
+
+void binary_process_start() {
+	struct uploader_cfg_data cfg;
+
+	cfg.cb_status = NULL;
+	cfg.interface.init_cb = binary_process_init;
+	cfg.interface.error_cb = NULL;
+	cfg.interface.is_done = binary_process_is_done;
+	cfg.interface.close_cb = binary_process_finish;
+	cfg.interface.process_cb = binary_process_data;
+	cfg.interface.flush_policy = &uploader_flush_bulk;
+	cfg.interface.chunk_size = BINARY_CHUNK_SIZE;
+	cfg.interface.progress_cb = binary_process_progress;
+	cfg.print_state = binary_print_status;
+
+	process_set_config(&cfg);
+}
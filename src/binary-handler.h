@@ -0,0 +1,49 @@
+/* Copyright 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BINARY_HANDLER_H__
+#define __BINARY_HANDLER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Frames of the binary transfer, all fields little endian:
+ *
+ *   0  sync    BINARY_SYNC
+ *   1  type    BINARY_FRAME_DATA or BINARY_FRAME_END
+ *   2  length  Payload bytes, 0 for BINARY_FRAME_END
+ *   4  offset  Where the payload goes in the file, the file size for
+ *              BINARY_FRAME_END
+ *   8  crc     CRC-32 of the 8 bytes above
+ *  12  payload
+ *      crc     CRC-32 of the payload
+ */
+#define BINARY_SYNC        0xA5
+#define BINARY_FRAME_DATA  0x01
+#define BINARY_FRAME_END   0x02
+
+#define BINARY_HEADER_SIZE 12
+#define BINARY_CRC_SIZE    4
+
+/* Largest payload of a frame when the upload is compressed */
+#define BINARY_LZ_MAX_PAYLOAD 496
+
+void binary_process_start();
+
+/* IEEE 802.3 CRC-32, start with 0 and feed the data in any pieces */
+uint32_t binary_crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif
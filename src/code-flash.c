@@ -0,0 +1,260 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+* @file
+* @brief Files in a raw flash partition that can be read in place
+*
+* The layout is described in code-flash.h. Everything is read through the
+* memory mapping, the flash driver is only used to erase and write.
+*/
+
+#include <nanokernel.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <device.h>
+#include <flash.h>
+
+#include "code-flash.h"
+#include "uploader-trace.h"
+#include "uploader-log.h"
+
+#if (CODE_FLASH_SLOT_SIZE % CONFIG_CODE_FLASH_PAGE_SIZE) != 0
+#error "Flash slots have to be a multiple of the flash page"
+#endif
+
+#define CODE_FLASH_MAGIC  0x4A534346   /* "FCSJ" */
+#define CODE_FLASH_ERASED 0xFFFFFFFF
+
+struct code_flash_header {
+	uint32_t magic;
+	uint32_t size;            /* CODE_FLASH_ERASED until the file is done */
+	char name[CODE_FLASH_NAME_SIZE];
+};
+
+static struct device *flash_dev;
+
+static uintptr_t slot_address(int slot) {
+	return (uintptr_t)CONFIG_CODE_FLASH_ADDRESS +
+		(uintptr_t)slot * CODE_FLASH_SLOT_SIZE;
+}
+
+static const struct code_flash_header *slot_header(int slot) {
+	return (const struct code_flash_header *)slot_address(slot);
+}
+
+static struct device *code_flash_device(void) {
+	if (flash_dev == NULL) {
+		flash_dev = device_get_binding(CONFIG_CODE_FLASH_DEV_NAME);
+		if (flash_dev == NULL)
+			LOG_ERR("No flash device %s\n", CONFIG_CODE_FLASH_DEV_NAME);
+	}
+	return flash_dev;
+}
+
+/* Whole words only, at a word aligned address */
+static int code_flash_program(uintptr_t address, const void *buf, size_t len) {
+	struct device *dev = code_flash_device();
+	int res;
+
+	if (dev == NULL)
+		return -ENODEV;
+
+	flash_write_protection_set(dev, false);
+	res = flash_write(dev, address, buf, len);
+	flash_write_protection_set(dev, true);
+	trace_add(TRACE_WRITE, len, res ? res : (int32_t)len);
+	if (res)
+		LOG_ERR("Failed writing to flash [%d]\n", res);
+	return res;
+}
+
+int code_flash_stat(int slot, const char **name, uint32_t *size) {
+	const struct code_flash_header *header = slot_header(slot);
+
+	if (slot < 0 || slot >= CONFIG_CODE_FLASH_SLOTS)
+		return -EINVAL;
+
+	if (header->magic != CODE_FLASH_MAGIC ||
+		header->size == CODE_FLASH_ERASED ||
+		header->size > CODE_FLASH_MAX_FILE)
+		return -ENOENT;
+
+	*name = header->name;
+	*size = header->size;
+	return 0;
+}
+
+static int code_flash_find(const char *name) {
+	const char *slot_name;
+	uint32_t size;
+	int slot;
+
+	for (slot = 0; slot < CONFIG_CODE_FLASH_SLOTS; slot++) {
+		if (code_flash_stat(slot, &slot_name, &size) == 0 &&
+			strncmp(slot_name, name, CODE_FLASH_NAME_SIZE) == 0)
+			return slot;
+	}
+	return -ENOENT;
+}
+
+int code_flash_open(struct code_flash_file *file, const char *name) {
+	const char *slot_name;
+	int slot = code_flash_find(name);
+
+	if (slot < 0)
+		return slot;
+
+	file->slot = slot;
+	file->data = (const char *)(slot_address(slot) + CODE_FLASH_HEADER_SIZE);
+	code_flash_stat(slot, &slot_name, &file->size);
+	file->tail_len = 0;
+	file->writing = false;
+	return 0;
+}
+
+/*
+ * @brief Takes the slot of the file with that name, or a free one
+ *
+ * The old file is gone as soon as the slot is erased, like a file system
+ * file that is opened for writing.
+ */
+int code_flash_create(struct code_flash_file *file, const char *name) {
+	struct code_flash_header header;
+	struct device *dev = code_flash_device();
+	const char *slot_name;
+	uint32_t size;
+	int slot, res;
+
+	if (dev == NULL)
+		return -ENODEV;
+	if (strlen(name) >= CODE_FLASH_NAME_SIZE)
+		return -ENAMETOOLONG;
+
+	slot = code_flash_find(name);
+	if (slot < 0) {
+		for (slot = 0; slot < CONFIG_CODE_FLASH_SLOTS; slot++) {
+			if (code_flash_stat(slot, &slot_name, &size) != 0)
+				break;
+		}
+		if (slot == CONFIG_CODE_FLASH_SLOTS) {
+			LOG_ERR("No free flash slot\n");
+			return -ENOSPC;
+		}
+	}
+
+	flash_write_protection_set(dev, false);
+	res = flash_erase(dev, slot_address(slot), CODE_FLASH_SLOT_SIZE);
+	flash_write_protection_set(dev, true);
+	trace_add(TRACE_ERASE, slot, res);
+	if (res) {
+		LOG_ERR("Failed erasing flash [%d]\n", res);
+		return res;
+	}
+
+	/* The size is left erased, it gets written on close */
+	memset(&header, 0, sizeof(header));
+	header.magic = CODE_FLASH_MAGIC;
+	header.size = CODE_FLASH_ERASED;
+	strcpy(header.name, name);
+	res = code_flash_program(slot_address(slot), &header, sizeof(header));
+	if (res)
+		return res;
+
+	file->slot = slot;
+	file->data = (const char *)(slot_address(slot) + CODE_FLASH_HEADER_SIZE);
+	file->size = 0;
+	file->tail_len = 0;
+	file->writing = true;
+	return 0;
+}
+
+/*
+ * @brief Appends to the file
+ *
+ * Up to a word is held back until the rest of it arrives or the file is
+ * closed.
+ */
+int code_flash_write(struct code_flash_file *file, const char *buf, size_t len) {
+	uintptr_t next = (uintptr_t)file->data + file->size - file->tail_len;
+	size_t room;
+	int res;
+
+	if (!file->writing)
+		return -EBADF;
+	if (len > CODE_FLASH_MAX_FILE - file->size)
+		return -ENOSPC;
+
+	file->size += len;
+
+	if (file->tail_len > 0) {
+		room = CODE_FLASH_WORD_SIZE - file->tail_len;
+		if (room > len)
+			room = len;
+		memcpy(&file->tail[file->tail_len], buf, room);
+		file->tail_len += room;
+		buf += room;
+		len -= room;
+
+		if (file->tail_len < CODE_FLASH_WORD_SIZE)
+			return 0;
+
+		res = code_flash_program(next, file->tail, CODE_FLASH_WORD_SIZE);
+		if (res)
+			return res;
+		next += CODE_FLASH_WORD_SIZE;
+		file->tail_len = 0;
+	}
+
+	room = len - (len % CODE_FLASH_WORD_SIZE);
+	if (room > 0) {
+		res = code_flash_program(next, buf, room);
+		if (res)
+			return res;
+		buf += room;
+		len -= room;
+	}
+
+	memcpy(file->tail, buf, len);
+	file->tail_len = len;
+	return 0;
+}
+
+/* Writes what is held back and the size, which makes the file valid */
+int code_flash_close(struct code_flash_file *file) {
+	uintptr_t next = (uintptr_t)file->data + file->size - file->tail_len;
+	uint32_t size = file->size;
+	int res;
+
+	if (!file->writing)
+		return 0;
+	file->writing = false;
+
+	if (file->tail_len > 0) {
+		memset(&file->tail[file->tail_len], 0xFF,
+			CODE_FLASH_WORD_SIZE - file->tail_len);
+		res = code_flash_program(next, file->tail, CODE_FLASH_WORD_SIZE);
+		if (res)
+			return res;
+		file->tail_len = 0;
+	}
+
+	return code_flash_program(slot_address(file->slot) +
+		offsetof(struct code_flash_header, size), &size, sizeof(size));
+}
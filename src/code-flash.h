@@ -0,0 +1,81 @@
+/* Copyright 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CODE_FLASH_H__
+#define __CODE_FLASH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Scripts kept whole in a raw partition of the memory mapped internal
+ * flash, so the engine can read them where they are:
+ *
+ *   slot    CODE_FLASH_SLOT_SIZE bytes, a header and the file right after it
+ *   header  magic, size and name. The magic is written when the slot is
+ *           taken, the size once the file is complete. A slot with the
+ *           magic but no size is a write that never finished and is free.
+ *
+ * Files are written in order, flash is only erased a slot at a time. The
+ * default partition is the upper part of the ARC flash, which is free with
+ * CONFIG_ARC_INIT=n. Check the flash map of the board before changing it.
+ */
+#ifndef CONFIG_CODE_FLASH_DEV_NAME
+#define CONFIG_CODE_FLASH_DEV_NAME "QUARK_FLASH"
+#endif
+
+/* The flash driver takes the mapped addresses as offsets */
+#ifndef CONFIG_CODE_FLASH_ADDRESS
+#define CONFIG_CODE_FLASH_ADDRESS 0x40020000
+#endif
+
+#ifndef CONFIG_CODE_FLASH_SIZE
+#define CONFIG_CODE_FLASH_SIZE (64 * 1024)
+#endif
+
+#ifndef CONFIG_CODE_FLASH_SLOTS
+#define CONFIG_CODE_FLASH_SLOTS 4
+#endif
+
+/* Erase unit, slots are a multiple of it */
+#ifndef CONFIG_CODE_FLASH_PAGE_SIZE
+#define CONFIG_CODE_FLASH_PAGE_SIZE 2048
+#endif
+
+#define CODE_FLASH_SLOT_SIZE  (CONFIG_CODE_FLASH_SIZE / CONFIG_CODE_FLASH_SLOTS)
+#define CODE_FLASH_HEADER_SIZE 32
+#define CODE_FLASH_MAX_FILE   (CODE_FLASH_SLOT_SIZE - CODE_FLASH_HEADER_SIZE)
+#define CODE_FLASH_NAME_SIZE  16
+
+/* Flash is written a word at a time */
+#define CODE_FLASH_WORD_SIZE  4
+
+struct code_flash_file {
+	int slot;
+	const char *data;         /* Mapped address of the file */
+	uint32_t size;            /* Complete file, or written so far */
+	uint8_t tail[CODE_FLASH_WORD_SIZE];
+	uint32_t tail_len;        /* Bytes of a word that is not written yet */
+	bool writing;
+};
+
+int code_flash_open(struct code_flash_file *file, const char *name);
+int code_flash_create(struct code_flash_file *file, const char *name);
+int code_flash_write(struct code_flash_file *file, const char *buf, size_t len);
+int code_flash_close(struct code_flash_file *file);
+int code_flash_stat(int slot, const char **name, uint32_t *size);
+
+#endif
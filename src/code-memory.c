@@ -34,49 +34,324 @@
 #include <init.h>
 
 #include <misc/printk.h>
-#include <malloc.h>
 #include "code-memory.h"
+#include "code-flash.h"
+#include "code-meta.h"
+#include "binary-handler.h"
+#include "uploader-timing.h"
+#include "uploader-trace.h"
+#include "uploader-log.h"
+
+/*
+ * Handles are only opened and closed from the acm task. Every error path
+ * closes the file but leaves the handle with its owner, csclose() is what
+ * gives it back to the pool.
+ */
+static CODE code_handles[CODE_MAX_HANDLES];
+static uint32_t handles_open;
+static uint32_t handles_high;
+static uint32_t handles_failed;
+static uint32_t handles_exhausted;
+
+static enum code_storage storage = CODE_STORAGE_FAT;
+
+void code_memory_set_storage(enum code_storage where) {
+	storage = where;
+}
+
+enum code_storage code_memory_get_storage(void) {
+	return storage;
+}
+
+static CODE *cs_alloc(void) {
+	uint32_t t;
+
+	for (t = 0; t < CODE_MAX_HANDLES; t++) {
+		if (code_handles[t].state == CODE_FREE) {
+			code_handles[t].state = CODE_OPEN;
+			if (++handles_open > handles_high)
+				handles_high = handles_open;
+			return &code_handles[t];
+		}
+	}
+
+	handles_exhausted++;
+	return NULL;
+}
+
+static void cs_release(CODE *fp) {
+	fp->state = CODE_FREE;
+	handles_open--;
+}
+
+/* Closes the file after an error, the owner still has to csclose() */
+static void cs_fail(CODE *fp) {
+	/* A flash file that was not closed stays invalid */
+	if (fp->storage == CODE_STORAGE_FAT)
+		fs_close(&fp->file);
+	fp->flash.writing = false;
+	fp->state = CODE_FAILED;
+	handles_failed++;
+}
 
 int csexist(const char *path) {
-	int res;
+	return cslength(path) >= 0;
+}
+
+/*
+ * @brief Size of a file without opening it
+ *
+ * Files in the root directory are answered from the metadata cache.
+ *
+ * @return -1 when there is no such file
+ */
+ssize_t cslength(const char *path) {
+	const struct code_meta *meta;
 	struct zfs_dirent entry;
-	res = fs_stat(path, &entry);
-	return !res;
+	struct code_flash_file file;
+	bool absent;
+
+	if (storage == CODE_STORAGE_FLASH)
+		return code_flash_open(&file, path) ? -1 : (ssize_t)file.size;
+
+	meta = code_meta_find(path, &absent);
+	if (meta != NULL)
+		return meta->size;
+	if (absent)
+		return -1;
+
+	if (fs_stat(path, &entry))
+		return -1;
+	return entry.size;
+}
+
+/* CRC-32 of a file if it is known without reading it, -ENOENT if not */
+int csgethash(const char *path, uint32_t *crc) {
+	const struct code_meta *meta;
+	bool absent;
+
+	if (storage == CODE_STORAGE_FLASH)
+		return -ENOENT;
+
+	meta = code_meta_find(path, &absent);
+	if (meta == NULL || !(meta->flags & CODE_META_CRC))
+		return -ENOENT;
+
+	*crc = meta->crc;
+	return 0;
+}
+
+/* Remembers a CRC-32 that was worked out by reading the whole file */
+void cssethash(const char *path, uint32_t size, uint32_t crc) {
+	if (storage == CODE_STORAGE_FAT)
+		code_meta_set_crc(path, size, crc);
 }
 
 CODE *csopen(const char * filename, const char * mode) {
-	printk("[OPEN] %s\n",filename);
+	LOG_DBG("[OPEN] %s\n", filename);
 	int res;
 
+	CODE *code = cs_alloc();
+	if (code == NULL) {
+		LOG_ERR("No free file handles\n");
+		trace_add(TRACE_OPEN, mode[0], -ENFILE);
+		return NULL;
+	}
+
+	code->storage = storage;
+	code->position = 0;
+	code->cache_len = 0;
+	code->read_len = 0;
+	code->read_pos = 0;
+	code->end = 0;
+	code->hash = 0;
+	code->hash_ok = (mode[0] == 'w' && storage == CODE_STORAGE_FAT);
+	code->created = (mode[0] == 'w');
+	code->written = false;
+	/* Names that do not fit are not cached */
+	if (strlen(filename) < MAX_FILENAME_SIZE)
+		strcpy(code->name, filename);
+	else
+		code->name[0] = '\0';
+
+	if (storage == CODE_STORAGE_FLASH) {
+		if (mode[0] == 'w')
+			res = code_flash_create(&code->flash, filename);
+		else
+			res = code_flash_open(&code->flash, filename);
+		trace_add(TRACE_OPEN, mode[0], res);
+		if (res) {
+			LOG_ERR("Failed opening flash file [%d]\n", res);
+			cs_release(code);
+			return NULL;
+		}
+		return code;
+	}
+
 	/* Delete file if exists */
 	if (mode[0] == 'w') {
 		if (csexist(filename)) {
 			/* Delete the file and verify checking its status */
 			res = fs_unlink(filename);
 			if (res) {
-				printk("Error deleting file [%d]\n", res);
+				LOG_ERR("Error deleting file [%d]\n", res);
+				trace_add(TRACE_OPEN, mode[0], res);
+				cs_release(code);
 				return NULL;
 			}
+			code_meta_remove(filename);
 		}
 	}
 
-	CODE *code = (CODE *)malloc(sizeof(CODE));
-	res = fs_open(code, filename);
+	res = fs_open(&code->file, filename);
+	trace_add(TRACE_OPEN, mode[0], res);
 	if (res) {
-		printk("Failed opening file [%d]\n", res);
+		LOG_ERR("Failed opening file [%d]\n", res);
+		cs_release(code);
 		return NULL;
 	}
+	code->flash.writing = false;
+
+	/* The file system creates missing files whatever the mode */
+	if (code->created || !csexist(filename))
+		code_meta_update(filename, 0, true, 0);
 	return code;
 }
 
+/* Where the file system puts the data, the cache is written before it */
+static ssize_t cs_fs_write(CODE *fp, const char *ptr, size_t size) {
+	ssize_t brw;
+	uint32_t start;
+
+	start = timing_start();
+	if (fp->storage == CODE_STORAGE_FLASH) {
+		brw = code_flash_write(&fp->flash, ptr, size);
+		if (brw == 0)
+			brw = size;
+	} else {
+		brw = fs_write(&fp->file, ptr, size);
+		trace_add(TRACE_WRITE, size, brw);
+	}
+	timing_stop(TIMING_WRITE, start, (brw > 0) ? brw : 0);
+	if (brw < 0 || (size_t)brw != size) {
+		LOG_ERR("Failed writing to file [%d]\n", brw);
+		cs_fail(fp);
+		return (brw < 0) ? brw : -EIO;
+	}
+	return brw;
+}
+
+int csflush(CODE *fp) {
+	ssize_t brw;
+	uint32_t len = fp->cache_len;
+
+	if (fp->state != CODE_OPEN)
+		return -EIO;
+	if (len == 0)
+		return 0;
+
+	fp->cache_len = 0;
+	brw = cs_fs_write(fp, fp->cache, len);
+	return (brw < 0) ? brw : 0;
+}
+
+/* Forgets what was read ahead, the file goes back to the reader */
+static int cs_drop_read(CODE *fp) {
+	int res = 0;
+
+	if (fp->read_pos != fp->read_len)
+		res = fs_seek(&fp->file, fp->position, SEEK_SET);
+	fp->read_len = 0;
+	fp->read_pos = 0;
+
+	if (res) {
+		LOG_ERR("fs_seek failed [%d]\n", res);
+		trace_add(TRACE_SEEK, SEEK_SET, res);
+		cs_fail(fp);
+	}
+	return res;
+}
+
+/* Flash files are read anywhere but only written in order */
+static int cs_flash_seek(CODE *fp, uint32_t target) {
+	char erased[32];
+	uint32_t len;
+	int res;
+
+	if (fp->flash.writing && target < fp->flash.size) {
+		LOG_ERR("Flash files are written in order\n");
+		trace_add(TRACE_SEEK, SEEK_SET, -ENOTSUP);
+		return -ENOTSUP;
+	}
+
+	/* Skipped data reads as erased flash */
+	memset(erased, 0xFF, sizeof(erased));
+	while (fp->flash.writing && fp->flash.size < target) {
+		len = target - fp->flash.size;
+		if (len > sizeof(erased))
+			len = sizeof(erased);
+		res = code_flash_write(&fp->flash, erased, len);
+		if (res) {
+			cs_fail(fp);
+			return res;
+		}
+	}
+
+	fp->position = target;
+	return 0;
+}
+
 int csseek(CODE *fp, long int offset, int whence) {
-	int res = fs_seek(fp, offset, whence);
+	uint32_t target = (whence == SEEK_SET) ? offset : fp->position + offset;
+	uint32_t start = fp->position - fp->read_pos;
+	int res;
+
+	if (fp->state != CODE_OPEN)
+		return -EIO;
+
+	/* Already there, the cache can stay */
+	if (whence != SEEK_END && target == fp->position)
+		return 0;
+
+	/* Still in what was read ahead */
+	if (whence != SEEK_END && fp->read_len > 0 &&
+		target >= start && target <= start + fp->read_len) {
+		fp->read_pos = target - start;
+		fp->position = target;
+		return 0;
+	}
+
+	res = csflush(fp);
+	if (res)
+		return res;
+
+	/* The file is not where the reader is, SEEK_CUR goes by the reader */
+	fp->read_len = 0;
+	fp->read_pos = 0;
+	if (fp->storage == CODE_STORAGE_FLASH) {
+		if (whence == SEEK_END)
+			target = fp->flash.size + offset;
+		return cs_flash_seek(fp, target);
+	}
+	if (whence == SEEK_CUR) {
+		offset = target;
+		whence = SEEK_SET;
+	}
+
+	res = fs_seek(&fp->file, offset, whence);
 	if (res) {
-		printk("fs_seek failed [%d]\n", res);
-		fs_close(fp);
+		LOG_ERR("fs_seek failed [%d]\n", res);
+		trace_add(TRACE_SEEK, whence, res);
+		cs_fail(fp);
 		return res;
 	}
 
+	fp->position = fs_tell(&fp->file);
+	if (fp->position > fp->end) {
+		/* A seek past the end leaves a gap that was not hashed */
+		fp->hash_ok = fp->hash_ok && whence == SEEK_END;
+		fp->end = fp->position;
+	}
 	return 0;
 }
 
@@ -84,44 +359,237 @@ ssize_t cssize(CODE *file) {
 	if (csseek(file, 0, SEEK_END)!=0)
 		return -1;
 
-	off_t file_len = fs_tell(file);
-	return file_len;
+	return file->position;
 }
 
+/*
+ * Data goes to the cache up to the next sector boundary, where the cache
+ * is written out. Whole sectors starting on a boundary skip the cache.
+ */
 ssize_t cswrite(const char * ptr, size_t size, size_t count, CODE * fp) {
+	size_t done = 0;
+	size_t room;
 	ssize_t brw;
 	size *= count;
 
-	brw = fs_write(fp, (const char *) ptr, size);
-	if (brw < 0) {
-		printk("Failed writing to file [%d]\n", brw);
-		fs_close(fp);
+	if (fp->state != CODE_OPEN || cs_drop_read(fp))
 		return 0;
-	}
-	else {
-		printk("Saved [%d]\n", brw);
+
+	fp->written = true;
+	if (fp->position != fp->end)
+		fp->hash_ok = false;
+
+	while (done < size) {
+		room = CODE_SECTOR_SIZE - (fp->position % CODE_SECTOR_SIZE);
+
+		if (fp->cache_len == 0 && room == CODE_SECTOR_SIZE &&
+			size - done >= CODE_SECTOR_SIZE) {
+			room = (size - done) - ((size - done) % CODE_SECTOR_SIZE);
+			brw = cs_fs_write(fp, ptr + done, room);
+			if (brw < 0)
+				return 0;
+		} else {
+			if (room > size - done)
+				room = size - done;
+			memcpy(&fp->cache[fp->cache_len], ptr + done, room);
+			fp->cache_len += room;
+		}
+
+		fp->position += room;
+		if (fp->position > fp->end)
+			fp->end = fp->position;
+		if (fp->hash_ok)
+			fp->hash = binary_crc32(fp->hash, ptr + done, room);
+		done += room;
+
+		if ((fp->position % CODE_SECTOR_SIZE) == 0 && csflush(fp))
+			return 0;
 	}
 
-	return brw;
+	return done;
 }
 
-ssize_t csread(char * ptr, size_t size, size_t count, CODE * fp) {
-	ssize_t brw = fs_read(fp, ptr, size);
+/* Reads from where the cache left the file, the cache is written first */
+static ssize_t cs_fs_read(CODE *fp, char *ptr, size_t size) {
+	ssize_t brw;
+
+	if (csflush(fp))
+		return -1;
+
+	fp->read_len = 0;
+	fp->read_pos = 0;
+	brw = fs_read(&fp->file, ptr, size);
 	if (brw < 0) {
-		printk("Failed reading file [%d]\n", brw);
-		fs_close(fp);
+		LOG_ERR("Failed reading file [%d]\n", brw);
+		trace_add(TRACE_READ, size, brw);
+		cs_fail(fp);
 		return -1;
 	}
 	return brw;
 }
 
+/*
+ * @brief Data at the position without copying it
+ *
+ * Reads ahead up to the next sector boundary when nothing is left in the
+ * cache. The span stays valid until the next call on the handle, csskip()
+ * moves past what was used.
+ *
+ * @return Bytes in the span, 0 at the end of the file, -1 on errors
+ */
+ssize_t cspeek(CODE *fp, const char **span) {
+	uint32_t end = fp->flash.size - fp->flash.tail_len;
+	ssize_t brw;
+
+	/* Straight from the mapped flash */
+	if (fp->storage == CODE_STORAGE_FLASH) {
+		if (csflush(fp))
+			return -1;
+		*span = fp->flash.data + fp->position;
+		return (fp->position < end) ? end - fp->position : 0;
+	}
+
+	if (fp->read_pos == fp->read_len) {
+		brw = cs_fs_read(fp, fp->cache,
+			CODE_SECTOR_SIZE - (fp->position % CODE_SECTOR_SIZE));
+		if (brw < 0)
+			return -1;
+		fp->read_len = brw;
+	}
+
+	*span = &fp->cache[fp->read_pos];
+	return fp->read_len - fp->read_pos;
+}
+
+void csskip(CODE *fp, size_t len) {
+	if (fp->storage == CODE_STORAGE_FLASH) {
+		fp->position += len;
+		return;
+	}
+
+	if (len > fp->read_len - fp->read_pos)
+		len = fp->read_len - fp->read_pos;
+	fp->read_pos += len;
+	fp->position += len;
+}
+
+/*
+ * Like fread, returns the number of whole items read. Reads of a sector
+ * or more go straight to ptr once the cache is used up.
+ */
+ssize_t csread(char * ptr, size_t size, size_t count, CODE * fp) {
+	const char *span;
+	size_t done = 0;
+	ssize_t brw;
+	size_t total = size * count;
+
+	while (done < total) {
+		if (fp->storage == CODE_STORAGE_FAT &&
+			fp->read_pos == fp->read_len &&
+			total - done >= CODE_SECTOR_SIZE) {
+			brw = cs_fs_read(fp, ptr + done, total - done);
+			if (brw < 0)
+				return -1;
+			fp->position += brw;
+			done += brw;
+			if (brw == 0)
+				break;
+			continue;
+		}
+
+		brw = cspeek(fp, &span);
+		if (brw < 0)
+			return -1;
+		if (brw == 0)
+			break;
+		if ((size_t)brw > total - done)
+			brw = total - done;
+		memcpy(ptr + done, span, brw);
+		csskip(fp, brw);
+		done += brw;
+	}
+
+	return size ? done / size : 0;
+}
+
 int csclose(CODE * fp) {
-	printk("[CLOSE]\n");
-	int res = fs_close(fp);
-	free(fp);
+	LOG_DBG("[CLOSE]\n");
+	int res = -EIO;
+
+	if (fp->state == CODE_FREE)
+		return -EINVAL;
+
+	/* A failed flush closes the file itself */
+	if (fp->state == CODE_OPEN) {
+		res = csflush(fp);
+		if (!res && fp->storage == CODE_STORAGE_FLASH)
+			res = code_flash_close(&fp->flash);
+		else if (!res)
+			res = fs_close(&fp->file);
+	}
+
+	/* Only files written from empty have a known size */
+	if (fp->storage == CODE_STORAGE_FAT && (fp->written || fp->created)) {
+		if (!res && fp->created)
+			code_meta_update(fp->name, fp->end, fp->hash_ok, fp->hash);
+		else
+			code_meta_stale(fp->name);
+	}
+	trace_add(TRACE_CLOSE, 0, res);
+	cs_release(fp);
 	return res;
 }
 
+/*
+ * @brief Where a flash file can be read in place
+ * @return NULL for file system files and flash files still being written
+ */
+const char *csmap(CODE *fp, size_t *size) {
+	if (fp->state != CODE_OPEN || fp->storage != CODE_STORAGE_FLASH ||
+		fp->flash.writing)
+		return NULL;
+
+	*size = fp->flash.size;
+	return fp->flash.data;
+}
+
+static int code_flash_used(void) {
+	const char *name;
+	uint32_t size;
+	int slot, used = 0;
+
+	for (slot = 0; slot < CONFIG_CODE_FLASH_SLOTS; slot++) {
+		if (code_flash_stat(slot, &name, &size) == 0)
+			used++;
+	}
+	return used;
+}
+
+void code_memory_print_status(void) {
+	printf("[Files] Open %d/%d High %d Failed %d Exhausted %d\n",
+		(int)handles_open, CODE_MAX_HANDLES, (int)handles_high,
+		(int)handles_failed, (int)handles_exhausted);
+	printf("[Storage] %s Flash slots %d/%d of %d bytes\n",
+		(storage == CODE_STORAGE_FLASH) ? "flash" : "fat",
+		code_flash_used(), CONFIG_CODE_FLASH_SLOTS, CODE_FLASH_MAX_FILE);
+	code_meta_print_status();
+}
+
+void code_memory_dump_status(void) {
+	printf("files open=%u max=%u high=%u failed=%u exhausted=%u\n",
+		(unsigned int)handles_open, (unsigned int)CODE_MAX_HANDLES,
+		(unsigned int)handles_high, (unsigned int)handles_failed,
+		(unsigned int)handles_exhausted);
+	code_meta_dump_status();
+}
+
+void code_memory_reset_status(void) {
+	handles_high = handles_open;
+	handles_failed = 0;
+	handles_exhausted = 0;
+	code_meta_reset_status();
+}
+
 #ifdef CONFIG_CODE_MEMORY_TESTING
 void main() {
 	CODE *myfile;
@@ -25,14 +25,69 @@
 #include <fs/fat_fs.h>
 #include <fs.h>
 
-#define CODE ZFILE
+#include "code-flash.h"
+
+/*
+ * Writes are collected per handle and reach the file a sector at a time,
+ * the cache is written out when it reaches a sector boundary and before
+ * any seek, read or close. Reads fill the same cache up to the next sector
+ * boundary and are served from it.
+ */
+#define CODE_SECTOR_SIZE 512
+
+/* Handles come from a static pool, no more files than this are open */
+#define CODE_MAX_HANDLES 2
+
+enum code_state {
+	CODE_FREE,                /* In the pool */
+	CODE_OPEN,                /* Owned by whoever opened it */
+	CODE_FAILED               /* Still owned, the file was closed on an error */
+};
+
+/* Where csopen() looks for files, see code-flash.h for the flash one */
+enum code_storage {
+	CODE_STORAGE_FAT,
+	CODE_STORAGE_FLASH
+};
+
+typedef struct {
+	ZFILE file;
+	struct code_flash_file flash;
+	enum code_storage storage;
+	enum code_state state;
+	uint32_t position;        /* Where the next write or read goes */
+	uint32_t cache_len;       /* Bytes written since position - cache_len */
+	uint32_t read_len;        /* Bytes read ahead into the cache */
+	uint32_t read_pos;        /* The one at position */
+	uint32_t end;             /* Known end of the file */
+	uint32_t hash;            /* CRC-32 of what was written from the start */
+	bool hash_ok;             /* Written in order from an empty file */
+	bool created;             /* Opened for writing, the old file is gone */
+	bool written;
+	char name[MAX_FILENAME_SIZE];
+	char cache[CODE_SECTOR_SIZE];
+} CODE;
 
 CODE *csopen(const char *filename, const char *mode);
 int csexist(const char *path);
-int csseek(CODE *stream, long int offset, int whence);
-ssize_t cswrite(const char *ptr, size_t size, size_t count, CODE *stream);
+ssize_t cslength(const char *path);
+int csgethash(const char *path, uint32_t *crc);
+void cssethash(const char *path, uint32_t size, uint32_t crc);
+int csseek(CODE *stream, long int offset, int whence);
+ssize_t cswrite(const char *ptr, size_t size, size_t count, CODE *stream);
 ssize_t csread(char *ptr, size_t size, size_t count, CODE *stream);
+ssize_t cspeek(CODE *stream, const char **span);
+void csskip(CODE *stream, size_t len);
+int csflush(CODE *stream);
 int csclose(CODE * stream);
 ssize_t cssize(CODE *file);
+const char *csmap(CODE *stream, size_t *size);
+
+void code_memory_set_storage(enum code_storage storage);
+enum code_storage code_memory_get_storage(void);
+
+void code_memory_print_status(void);
+void code_memory_dump_status(void);
+void code_memory_reset_status(void);
 
 #endif
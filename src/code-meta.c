@@ -0,0 +1,272 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+* @file
+* @brief Names, sizes and CRCs of the files in the root directory
+*
+* Only used from the acm task, like the code-memory handles. When the whole
+* root directory fitted, a name that is not here does not exist either.
+*/
+
+#include <nanokernel.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <fs/fs_interface.h>
+#include <fs.h>
+
+#include "code-meta.h"
+#include "uploader-log.h"
+
+static struct code_meta entries[CONFIG_CODE_META_ENTRIES];
+static bool loaded;
+static bool complete;
+static uint32_t meta_hits;
+static uint32_t meta_misses;
+
+/* FAT names do not care about case */
+static bool code_meta_same(const char *a, const char *b) {
+	for (; *a && *b; a++, b++) {
+		if (tolower((int)*a) != tolower((int)*b))
+			return false;
+	}
+	return *a == *b;
+}
+
+/* Only names in the root directory that fit an entry are kept */
+static bool code_meta_cacheable(const char *name) {
+	if (*name == '/')
+		name++;
+	return *name && strchr(name, '/') == NULL &&
+		strlen(name) < CODE_META_NAME_SIZE;
+}
+
+static struct code_meta *code_meta_lookup(const char *name) {
+	uint32_t t;
+
+	if (*name == '/')
+		name++;
+	for (t = 0; t < CONFIG_CODE_META_ENTRIES; t++) {
+		if ((entries[t].flags & CODE_META_USED) &&
+			code_meta_same(entries[t].name, name))
+			return &entries[t];
+	}
+	return NULL;
+}
+
+static struct code_meta *code_meta_alloc(const char *name) {
+	uint32_t t;
+
+	if (*name == '/')
+		name++;
+	for (t = 0; t < CONFIG_CODE_META_ENTRIES; t++) {
+		if (!(entries[t].flags & CODE_META_USED)) {
+			strcpy(entries[t].name, name);
+			entries[t].flags = CODE_META_USED;
+			return &entries[t];
+		}
+	}
+
+	/* The file exists but a miss no longer says so */
+	complete = false;
+	return NULL;
+}
+
+/*
+ * @brief Reads the root directory into the cache
+ *
+ * Nothing is cached if the directory cannot be read, every lookup then
+ * goes to the file system.
+ */
+int code_meta_load(void) {
+	struct zfs_dirent entry;
+	struct code_meta *meta;
+	ZDIR dp;
+	int res;
+
+	memset(entries, 0, sizeof(entries));
+	loaded = false;
+	complete = true;
+
+	res = fs_opendir(&dp, "");
+	if (res) {
+		LOG_ERR("Failed reading the root directory [%d]\n", res);
+		return res;
+	}
+
+	for (;;) {
+		res = fs_readdir(&dp, &entry);
+		if (res || entry.name[0] == 0)
+			break;
+
+		meta = code_meta_alloc(entry.name);
+		if (meta == NULL)
+			break;
+		if (entry.type == DIR_ENTRY_DIR)
+			meta->flags |= CODE_META_DIR;
+		meta->size = entry.size;
+	}
+	fs_closedir(&dp);
+
+	if (res) {
+		LOG_ERR("Failed reading the root directory [%d]\n", res);
+		return res;
+	}
+
+	loaded = true;
+	return 0;
+}
+
+static bool code_meta_ready(void) {
+	return loaded || code_meta_load() == 0;
+}
+
+/*
+ * @brief Cached entry of a file or directory
+ *
+ * @param absent Set when the name is known not to exist
+ * @return NULL when the file system has to be asked, or absent is set
+ */
+const struct code_meta *code_meta_find(const char *name, bool *absent) {
+	struct code_meta *meta = NULL;
+
+	*absent = false;
+	if (code_meta_cacheable(name) && code_meta_ready()) {
+		meta = code_meta_lookup(name);
+		if (meta == NULL)
+			*absent = complete;
+		else if (meta->flags & CODE_META_STALE)
+			meta = NULL;
+	}
+
+	if (meta != NULL || *absent)
+		meta_hits++;
+	else
+		meta_misses++;
+	return meta;
+}
+
+/* Entries in directory order, NULL for unused ones and past the end */
+const struct code_meta *code_meta_entry(uint32_t index) {
+	if (index >= CONFIG_CODE_META_ENTRIES ||
+		!(entries[index].flags & CODE_META_USED))
+		return NULL;
+	return &entries[index];
+}
+
+/* True when every entry of the root directory is cached and up to date */
+bool code_meta_complete(void) {
+	uint32_t t;
+
+	if (!code_meta_ready() || !complete)
+		return false;
+
+	for (t = 0; t < CONFIG_CODE_META_ENTRIES; t++) {
+		if (entries[t].flags & CODE_META_STALE)
+			return false;
+	}
+	return true;
+}
+
+/* A file was written, has_crc when all of it went through code-memory */
+void code_meta_update(const char *name, uint32_t size, bool has_crc,
+	uint32_t crc) {
+	struct code_meta *meta;
+
+	if (!loaded || !code_meta_cacheable(name))
+		return;
+
+	meta = code_meta_lookup(name);
+	if (meta == NULL)
+		meta = code_meta_alloc(name);
+	if (meta == NULL)
+		return;
+
+	meta->flags = CODE_META_USED;
+	meta->size = size;
+	meta->crc = crc;
+	if (has_crc)
+		meta->flags |= CODE_META_CRC;
+}
+
+/* A CRC worked out by reading the file, kept if the file did not change */
+void code_meta_set_crc(const char *name, uint32_t size, uint32_t crc) {
+	struct code_meta *meta;
+
+	if (!loaded || !code_meta_cacheable(name))
+		return;
+
+	meta = code_meta_lookup(name);
+	if (meta == NULL || (meta->flags & CODE_META_STALE) || meta->size != size)
+		return;
+
+	meta->crc = crc;
+	meta->flags |= CODE_META_CRC;
+}
+
+/* The file changed in a way that is not known, ask the file system */
+void code_meta_stale(const char *name) {
+	struct code_meta *meta;
+
+	if (!loaded || !code_meta_cacheable(name))
+		return;
+
+	meta = code_meta_lookup(name);
+	if (meta == NULL)
+		meta = code_meta_alloc(name);
+	if (meta != NULL)
+		meta->flags = CODE_META_USED | CODE_META_STALE;
+}
+
+void code_meta_remove(const char *name) {
+	struct code_meta *meta;
+
+	if (!loaded || !code_meta_cacheable(name))
+		return;
+
+	meta = code_meta_lookup(name);
+	if (meta != NULL)
+		meta->flags = 0;
+}
+
+void code_meta_print_status(void) {
+	uint32_t t, used = 0;
+
+	for (t = 0; t < CONFIG_CODE_META_ENTRIES; t++) {
+		if (entries[t].flags & CODE_META_USED)
+			used++;
+	}
+
+	printf("[Meta] Entries %d/%d %s Hits %d Misses %d\n",
+		(int)used, CONFIG_CODE_META_ENTRIES,
+		!loaded ? "Empty" : complete ? "Complete" : "Partial",
+		(int)meta_hits, (int)meta_misses);
+}
+
+void code_meta_dump_status(void) {
+	printf("meta loaded=%u complete=%u hits=%u misses=%u\n",
+		(unsigned int)loaded, (unsigned int)complete,
+		(unsigned int)meta_hits, (unsigned int)meta_misses);
+}
+
+void code_meta_reset_status(void) {
+	meta_hits = 0;
+	meta_misses = 0;
+}
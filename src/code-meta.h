@@ -0,0 +1,68 @@
+/* Copyright 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CODE_META_H__
+#define __CODE_META_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <fs.h>
+
+/*
+ * Names, sizes and CRC-32s of the entries in the root directory. The cache
+ * is read from the file system on first use and code-memory keeps it up to
+ * date, so ls, du, crc and existence checks do not walk the FAT on the SPI
+ * flash. Paths with a directory in them, and entries that did not fit, are
+ * looked up on the file system.
+ */
+#ifndef CONFIG_CODE_META_ENTRIES
+#define CONFIG_CODE_META_ENTRIES 16
+#endif
+
+#define CODE_META_NAME_SIZE (MAX_FILE_NAME + 1)
+
+#define CODE_META_USED   (1 << 0)
+#define CODE_META_DIR    (1 << 1)
+#define CODE_META_CRC    (1 << 2)   /* crc holds the CRC-32 of the file */
+/*
+ * The size is unknown: the file was written without being created by that
+ * open, like one opened for reading or appending, or closing it failed.
+ */
+#define CODE_META_STALE  (1 << 3)
+
+struct code_meta {
+	char name[CODE_META_NAME_SIZE];
+	uint8_t flags;
+	uint32_t size;
+	uint32_t crc;
+};
+
+int code_meta_load(void);
+const struct code_meta *code_meta_find(const char *name, bool *absent);
+const struct code_meta *code_meta_entry(uint32_t index);
+bool code_meta_complete(void);
+
+void code_meta_update(const char *name, uint32_t size, bool has_crc,
+	uint32_t crc);
+void code_meta_set_crc(const char *name, uint32_t size, uint32_t crc);
+void code_meta_stale(const char *name);
+void code_meta_remove(const char *name);
+
+void code_meta_print_status(void);
+void code_meta_dump_status(void);
+void code_meta_reset_status(void);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+* @file
+* @brief Written ranges of an upload
+*
+* Lets the decoders tell holes and overlapping data apart from a file
+* that was simply written out of order.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "extent-map.h"
+
+void extent_map_init(struct extent_map *map) {
+	map->count = 0;
+	map->merged = 0;
+}
+
+uint32_t extent_map_add(struct extent_map *map, uint32_t start, uint32_t len) {
+	struct extent *extents = map->extents;
+	uint32_t end = start + len;
+	uint32_t overlap = 0;
+	uint32_t first, last, t;
+	uint32_t from, to;
+
+	if (len == 0)
+		return 0;
+
+	/* First extent that reaches start and the first one past end */
+	for (first = 0; first < map->count && extents[first].end < start; first++)
+		;
+	for (last = first; last < map->count && extents[last].start <= end; last++) {
+		from = (extents[last].start > start) ? extents[last].start : start;
+		to = (extents[last].end < end) ? extents[last].end : end;
+		if (to > from)
+			overlap += to - from;
+	}
+
+	/* Touches or overlaps extents first to last - 1, they become one */
+	if (last > first) {
+		if (extents[first].start < start)
+			start = extents[first].start;
+		if (extents[last - 1].end > end)
+			end = extents[last - 1].end;
+
+		extents[first].start = start;
+		extents[first].end = end;
+		memmove(&extents[first + 1], &extents[last],
+			(map->count - last) * sizeof(struct extent));
+		map->count -= last - first - 1;
+		return overlap;
+	}
+
+	if (map->count < EXTENT_MAP_SIZE) {
+		memmove(&extents[first + 1], &extents[first],
+			(map->count - first) * sizeof(struct extent));
+		extents[first].start = start;
+		extents[first].end = end;
+		map->count++;
+		return 0;
+	}
+
+	/* Full, grow the neighbour with the smaller gap over it */
+	map->merged++;
+	t = first;
+	if (t == map->count ||
+		(t > 0 && start - extents[t - 1].end < extents[t].start - end))
+		extents[t - 1].end = end;
+	else
+		extents[t].start = start;
+	return 0;
+}
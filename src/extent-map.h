@@ -0,0 +1,47 @@
+/* Copyright 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __EXTENT_MAP_H__
+#define __EXTENT_MAP_H__
+
+#include <stdint.h>
+
+/*
+ * Byte ranges of a file that have been written, sorted by address and
+ * merged whenever they touch. A file written in order is a single extent.
+ */
+#define EXTENT_MAP_SIZE 32
+
+struct extent {
+	uint32_t start;
+	uint32_t end;             /* One past the last byte */
+};
+
+struct extent_map {
+	struct extent extents[EXTENT_MAP_SIZE];
+	uint32_t count;
+	/* Gaps that were merged away because the table was full */
+	uint32_t merged;
+};
+
+void extent_map_init(struct extent_map *map);
+
+/*
+ * @brief Adds a range to the map
+ * @return Bytes of the range that were in the map already
+ */
+uint32_t extent_map_add(struct extent_map *map, uint32_t start, uint32_t len);
+
+#endif
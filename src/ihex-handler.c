@@ -48,6 +48,12 @@
 #include "uart-uploader.h"
 #include "ihex/kk_ihex_read.h"
 #include "acm-shell.h"
+#include "shell-state.h"
+#include "ihex-handler.h"
+#include "uploader-trace.h"
+#include "lz-stream.h"
+#include "extent-map.h"
+#include "uploader-log.h"
 
 #ifndef CONFIG_IHEX_UPLOADER_DEBUG
 #define DBG(...) { ; }
@@ -73,53 +79,580 @@ ZFILE fp;
 
 /****************************** IHEX ****************************************/
 
+/* Records come in bulk, take them in large chunks */
+#define IHEX_CHUNK_SIZE 512
+
 static bool marker = false;
+
+/*
+ * The byte-wise parser started a record that has not ended yet. kk_ihex
+ * starts over on a ':' without a word, so records that lost bytes on the
+ * way would be dropped silently and leave a hole.
+ */
+static bool record_open;
 static struct ihex_state ihex;
 
 static int8_t upload_state = 0;
 #define UPLOAD_START       0
 #define UPLOAD_IN_PROGRESS 1
 #define UPLOAD_FINISHED    2
+#define UPLOAD_RESYNC      3
 #define UPLOAD_ERROR       -1
 
+/*
+ * A bad record does not end the upload. Everything before it is kept, the
+ * host gets "[RESEND] <address>" and records are dropped until one starts
+ * between that address and resume_limit. Gives up after IHEX_MAX_RESYNCS
+ * bad records.
+ */
+#define IHEX_MAX_RESYNCS 16
+
+/* Where the host was asked to start again, the lowest missing address */
+static uint32_t resume_address;
+
+/*
+ * Last address the first resent record may start at. The resume address
+ * can be the start of a hole in the image, where no record starts, so the
+ * host resends from the next record it has. That is at most the start of
+ * the data received after the gap, or the bad record itself.
+ */
+static uint32_t resume_limit;
+
+/*
+ * Uploads with name records can carry several files in flight, so a name
+ * record does not tell the rewound stream from the old one. The host
+ * starts the rewound stream with an empty name record, then names the
+ * file the device announced last again. Everything before it is dropped.
+ */
+static bool resume_name;
+
+/*
+ * End of the data received when the host was asked to rewind. Records
+ * before it that land on data we have are the host sending them again,
+ * not overlaps in the image.
+ */
+static uint32_t resend_end;
+static uint32_t resyncs;
+static uint32_t resync_dropped;
+
+/* Data records and bytes accepted, what the acks count */
+static uint32_t accepted_records;
+static uint32_t accepted_bytes;
+
+/*
+ * What the upload wrote so far. Holes and overlapping records are only
+ * reported at the end, the file keeps the data of the last record.
+ */
+static struct extent_map extents;
+static uint32_t overlap_records;
+static uint32_t overlap_bytes;
+
+/*
+ * Records that start past write_address wait here, so the file is still
+ * written in address order when the hex tool emitted the records in some
+ * other order. The oldest ones go out when it fills up.
+ */
+#define IHEX_PENDING_SIZE    1024
+#define IHEX_PENDING_RECORDS 32
+
+struct ihex_pending {
+	uint32_t address;
+	uint16_t len;
+	uint16_t offset;          /* Data in pending_buf */
+};
+
+static uint8_t pending_buf[IHEX_PENDING_SIZE];
+static struct ihex_pending pending[IHEX_PENDING_RECORDS]; /* By address */
+static uint32_t pending_count;
+static uint32_t pending_used;
+static uint32_t reordered_records;
+
+/* End of the data handed to the stage in address order */
+static uint32_t write_address;
+
+/*
+ * Records only carry 16 to 32 bytes. Writing them one by one means a seek,
+ * a cluster lookup and a partial sector update on the flash for each one,
+ * so contiguous records are merged here and written a sector at a time.
+ */
+#define IHEX_STAGE_SIZE 512
+
+static char stage_buf[IHEX_STAGE_SIZE];
+static uint32_t stage_address;
+static uint32_t stage_len;
+static uint32_t stage_writes;
+
+/* File the data goes to, see IHEX_FILE_NAME_RECORD */
+static char file_name[MAX_FILENAME_SIZE];
+static bool file_named;
+static uint32_t files;
+
+/* Records decoded in one go and through the state machine */
+static uint32_t fast_records;
+static uint32_t slow_records;
+
+/* The records carry LZ data, inflated on the way to the file */
+static bool compressed;
+static uint32_t compressed_bytes;
+
+static bool ihex_lz_sink(const char *buf, uint32_t len) {
+	return cswrite(buf, len, 1, code_memory) == len;
+}
+
+void ihex_process_error(uint32_t address);
+
+/*
+ * @brief Feeds the stage to the inflater
+ *
+ * A compressed stream only makes sense in order. Data the host sends
+ * again, like after it rewound to its last ack, is skipped or trimmed.
+ * Data past a gap is dropped and the host is asked for the gap.
+ *
+ * @return Bytes taken care of, 0 on bad compressed data
+ */
+static size_t ihex_stage_inflate() {
+	uint32_t skip;
+
+	if (stage_address > compressed_bytes) {
+		if (upload_state != UPLOAD_RESYNC) {
+			stage_len = 0;
+			ihex_process_error(compressed_bytes);
+		}
+		return stage_len;
+	}
+
+	skip = compressed_bytes - stage_address;
+	if (skip >= stage_len)
+		return stage_len;
+
+	if (!lz_stream_feed(&upload_lz, (const uint8_t *)stage_buf + skip,
+		stage_len - skip))
+		return 0;
+
+	compressed_bytes += stage_len - skip;
+	return stage_len;
+}
+
+static bool ihex_stage_flush() {
+	size_t written;
+
+	if (stage_len == 0)
+		return true;
+
+	written = 0;
+	if (compressed) {
+		written = ihex_stage_inflate();
+		if (stage_len == 0)
+			return upload_state != UPLOAD_ERROR;
+	} else if (!csseek(code_memory, stage_address, SEEK_SET)) {
+		written = cswrite(stage_buf, stage_len, 1, code_memory);
+	}
+	trace_add(TRACE_FLUSH, stage_len, stage_address);
+
+	stage_len = 0;
+	stage_writes++;
+
+	if (written == 0) {
+		printf("Failed writting into file \n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * @brief Adds a record to the staging buffer
+ *
+ * The buffer is written out when the record is not contiguous with it and
+ * whenever it reaches a sector boundary, so writes stay sector aligned.
+ */
+static bool ihex_stage_write(uint32_t address, const uint8_t *data, uint32_t len) {
+	uint32_t room;
+
+	if (stage_len > 0 && address != stage_address + stage_len) {
+		if (!ihex_stage_flush())
+			return false;
+	}
+
+	while (len > 0) {
+		if (stage_len == 0)
+			stage_address = address;
+
+		room = IHEX_STAGE_SIZE - (address % IHEX_STAGE_SIZE);
+		if (room > len)
+			room = len;
+
+		memcpy(&stage_buf[stage_len], data, room);
+		stage_len += room;
+		address += room;
+		data += room;
+		len -= room;
+
+		if ((address % IHEX_STAGE_SIZE) == 0 && !ihex_stage_flush())
+			return false;
+	}
+	return true;
+}
+
+/* Hands data to the stage, seeking back only for holes and overlaps */
+static bool ihex_place(uint32_t address, const uint8_t *data, uint32_t len) {
+	if (!ihex_stage_write(address, data, len))
+		return false;
+	if (address + len > write_address)
+		write_address = address + len;
+	return true;
+}
+
+/* Newer data for bytes that are still waiting, whatever gets written first */
+static void ihex_pending_patch(uint32_t address, const uint8_t *data, uint32_t len) {
+	struct ihex_pending *entry;
+	uint32_t t, from, to;
+
+	for (t = 0; t < pending_count; t++) {
+		entry = &pending[t];
+		if (entry->address >= address + len)
+			break;
+		from = (entry->address > address) ? entry->address : address;
+		to = entry->address + entry->len;
+		if (to > address + len)
+			to = address + len;
+		if (to > from)
+			memcpy(&pending_buf[entry->offset + from - entry->address],
+				data + from - address, to - from);
+	}
+}
+
+static void ihex_pending_add(uint32_t address, const uint8_t *data, uint32_t len) {
+	uint32_t t;
+
+	for (t = pending_count; t > 0 && pending[t - 1].address > address; t--)
+		pending[t] = pending[t - 1];
+
+	pending[t].address = address;
+	pending[t].len = len;
+	pending[t].offset = pending_used;
+	memcpy(&pending_buf[pending_used], data, len);
+	pending_used += len;
+	pending_count++;
+	reordered_records++;
+}
+
+/* Writes the record with the lowest address and frees its room */
+static bool ihex_pending_write_first() {
+	struct ihex_pending first = pending[0];
+	uint32_t t;
+
+	if (!ihex_place(first.address, &pending_buf[first.offset], first.len))
+		return false;
+
+	memmove(&pending_buf[first.offset], &pending_buf[first.offset + first.len],
+		pending_used - first.offset - first.len);
+	pending_used -= first.len;
+
+	pending_count--;
+	for (t = 0; t < pending_count; t++) {
+		pending[t] = pending[t + 1];
+		if (pending[t].offset > first.offset)
+			pending[t].offset -= first.len;
+	}
+	return true;
+}
+
+/* Writes what can go now, or everything at the end of the upload */
+static bool ihex_pending_drain(bool all) {
+	while (pending_count > 0 && (all || pending[0].address <= write_address)) {
+		if (!ihex_pending_write_first())
+			return false;
+	}
+	return true;
+}
+
+/*
+ * @brief Takes a data record
+ *
+ * Records at write_address go to the stage right away and may let waiting
+ * ones follow. Records further ahead wait for the ones before them.
+ */
+static bool ihex_write_record(uint32_t address, const uint8_t *data, uint32_t len) {
+	uint32_t overlap;
+
+	/* A compressed stream is never rewritten, that is the host repeating */
+	overlap = extent_map_add(&extents, address, len);
+	if (overlap && address >= resend_end && !compressed) {
+		LOG_WRN("[IHEX] %d bytes at %d written again\n", (int)overlap,
+			(int)address);
+		overlap_records++;
+		overlap_bytes += overlap;
+	}
+
+	ihex_pending_patch(address, data, len);
+
+	while (address > write_address && (pending_count == IHEX_PENDING_RECORDS ||
+		pending_used + len > IHEX_PENDING_SIZE)) {
+		if (!ihex_pending_write_first())
+			return false;
+	}
+
+	if (address > write_address) {
+		ihex_pending_add(address, data, len);
+		return true;
+	}
+
+	return ihex_place(address, data, len) && ihex_pending_drain(false);
+}
+
+/* Tells the host about the holes and overlaps the file ended up with */
+static void ihex_report_extents() {
+	char line[40];
+	uint32_t t, from = 0;
+
+	for (t = 0; t < extents.count; t++) {
+		if (extents.extents[t].start > from) {
+			snprintf(line, sizeof(line), "[HOLE] %08X %d",
+				(unsigned int)from, (int)(extents.extents[t].start - from));
+			acm_println(line);
+		}
+		from = extents.extents[t].end;
+	}
+
+	if (overlap_records > 0) {
+		snprintf(line, sizeof(line), "[OVERLAP] %d records %d bytes",
+			(int)overlap_records, (int)overlap_bytes);
+		acm_println(line);
+	}
+}
+
+/*
+ * @brief Lowest address the current file is still missing
+ *
+ * Records may wait in pending past a gap, so the end of the last record
+ * is not where the host has to start again.
+ */
+static uint32_t ihex_first_missing() {
+	if (extents.count == 0 || extents.extents[0].start > 0)
+		return 0;
+	if (extents.extents[0].end < write_address)
+		return extents.extents[0].end;
+	return write_address;
+}
+
+/* Everything of the current file goes out, its holes get reported */
+static bool ihex_file_end() {
+	if (!ihex_pending_drain(true) || !ihex_stage_flush())
+		return false;
+
+	/* Compressed data is missing, the host was asked for it */
+	if (upload_state == UPLOAD_RESYNC)
+		return true;
+
+	if (compressed && !lz_stream_finish(&upload_lz)) {
+		acm_println("[ERR] Bad compressed data");
+		return false;
+	}
+
+	/* The last sector is still in the cache of the handle */
+	if (csflush(code_memory)) {
+		printf("Failed writting into file \n");
+		return false;
+	}
+
+	ihex_report_extents();
+	return true;
+}
+
+/*
+ * @brief Closes the current file, if any, and starts writing to name
+ *
+ * Tells the host with "[FILE] <name>", resend requests are relative to
+ * the file it announced last.
+ */
+static bool ihex_file_open(const char *name) {
+	char line[8 + MAX_FILENAME_SIZE];
+
+	if (code_memory != NULL) {
+		/* A file that still misses data cannot be closed */
+		if (!ihex_file_end() || upload_state == UPLOAD_RESYNC)
+			return false;
+		csclose(code_memory);
+		code_memory = NULL;
+	}
+
+	strncpy(file_name, name, MAX_FILENAME_SIZE - 1);
+	file_name[MAX_FILENAME_SIZE - 1] = '\0';
+	file_named = false;
+	code_memory = csopen(file_name, "w+");
+	if (code_memory == NULL)
+		return false;
+
+	files++;
+	stage_len = 0;
+	write_address = 0;
+	resume_address = 0;
+	resend_end = 0;
+	pending_count = 0;
+	pending_used = 0;
+	extent_map_init(&extents);
+	overlap_records = 0;
+	overlap_bytes = 0;
+	compressed_bytes = 0;
+	if (compressed)
+		lz_stream_init(&upload_lz, ihex_lz_sink);
+
+	snprintf(line, sizeof(line), "[FILE] %s", file_name);
+	acm_println(line);
+	return true;
+}
+
+/* Opens the file a name record asks for */
+static bool ihex_file_name_read(struct ihex_state *ihex) {
+	char name[MAX_FILENAME_SIZE];
+	uint32_t t;
+
+	/* Data records of the new file start over from address 0 */
+	ihex->address = 0;
+	ihex->segment = 0;
+
+	/* The host rewound, an upload that was not resyncing ignores it */
+	if (ihex->length == 0) {
+		if (upload_state == UPLOAD_RESYNC && resume_name) {
+			upload_state = UPLOAD_IN_PROGRESS;
+			resume_name = false;
+		}
+		return true;
+	}
+
+	if (ihex->length >= MAX_FILENAME_SIZE) {
+		acm_println("[ERR] Bad file name");
+		return false;
+	}
+
+	for (t = 0; t < ihex->length; t++) {
+		if (!isgraph(ihex->data[t])) {
+			acm_println("[ERR] Bad file name");
+			return false;
+		}
+		name[t] = ihex->data[t];
+	}
+	name[t] = '\0';
+
+	/* Names of files that were in flight */
+	if (upload_state == UPLOAD_RESYNC) {
+		resync_dropped++;
+		return true;
+	}
+
+	/* The host named it again after rewinding, the file keeps its data */
+	if (file_named && !strcmp(name, file_name))
+		return true;
+
+	if (!ihex_file_open(name))
+		return false;
+	file_named = true;
+	return true;
+}
+
 /* Data received from the buffer */
 ihex_bool_t ihex_data_read(struct ihex_state *ihex,
 						   ihex_record_type_t type,
 						   ihex_bool_t checksum_error) {
 
+	record_open = false;
+
 	if (checksum_error) {
-		upload_state = UPLOAD_ERROR;
-		acm_println("[ERR] Checksum_error");
+		trace_add(TRACE_CHECKSUM, type, IHEX_LINEAR_ADDRESS(ihex));
+		ihex_process_error(ihex_first_missing());
+		if (type == IHEX_FILE_NAME_RECORD)
+			resume_name = true;
+		if (upload_state == UPLOAD_RESYNC &&
+			IHEX_LINEAR_ADDRESS(ihex) >= resume_address &&
+			IHEX_LINEAR_ADDRESS(ihex) < resume_limit)
+			resume_limit = IHEX_LINEAR_ADDRESS(ihex);
 		return false;
 	};
 
 	if (type == IHEX_DATA_RECORD) {
-		upload_state = UPLOAD_IN_PROGRESS;
 		unsigned long address = (unsigned long)IHEX_LINEAR_ADDRESS(ihex);
-		ihex->data[ihex->length] = 0;
 
-		printk("%d::%d:: \n%s \n", (int)address, ihex->length, ihex->data);
+		/* Whatever the host sent after the bad record, until it rewinds */
+		if (upload_state == UPLOAD_RESYNC && (resume_name ||
+			address < resume_address || address > resume_limit)) {
+			resync_dropped++;
+			return true;
+		}
+
+		upload_state = UPLOAD_IN_PROGRESS;
+		LOG_DBG("%d::%d::\n", (int)address, ihex->length);
+
+		if (code_memory == NULL && !ihex_file_open(ashell_get_filename())) {
+			upload_state = UPLOAD_ERROR;
+			return false;
+		}
 
-		csseek(code_memory, address, SEEK_SET);
-		size_t written = cswrite(ihex->data, ihex->length, 1, code_memory);
-		if (written == 0) {
-			printf("Failed writting into file \n");
+		if (!ihex_write_record(address, ihex->data, ihex->length)) {
 			upload_state = UPLOAD_ERROR;
 			return false;
 		}
+		accepted_records++;
+		accepted_bytes += ihex->length;
 	} else if (type == IHEX_END_OF_FILE_RECORD) {
+		/* The end of the stream that had the bad record */
+		if (upload_state == UPLOAD_RESYNC) {
+			resync_dropped++;
+			return true;
+		}
+
+		/* Still creates the file when nothing was sent */
+		if (code_memory == NULL && !ihex_file_open(ashell_get_filename())) {
+			upload_state = UPLOAD_ERROR;
+			return false;
+		}
+
+		if (!ihex_file_end()) {
+			upload_state = UPLOAD_ERROR;
+			return false;
+		}
+		if (upload_state == UPLOAD_RESYNC)
+			return true;
 		acm_println("[EOF]");
 		upload_state = UPLOAD_FINISHED;
+	} else if (type == IHEX_FILE_NAME_RECORD) {
+		if (!ihex_file_name_read(ihex)) {
+			upload_state = UPLOAD_ERROR;
+			return false;
+		}
 	}
 	return true;
 }
 
 /**************************** DEVICE **********************************/
 /*
-* Negotiate a re-upload
+* Negotiate a re-upload from address, keeping what is already written
 */
-void ihex_process_error(uint32_t error) {
-	printf("[Download Error]\n");
+void ihex_process_error(uint32_t address) {
+	char line[24];
+	uint32_t t;
+
+	/* The rewound stream has to find everything before it on the file */
+	if (++resyncs > IHEX_MAX_RESYNCS || !ihex_stage_flush()) {
+		upload_state = UPLOAD_ERROR;
+		acm_println("[ERR] Checksum_error");
+		return;
+	}
+
+	/* Named uploads rewind behind an empty name record, see resume_name */
+	resume_name = file_named || (resume_name && upload_state == UPLOAD_RESYNC);
+	upload_state = UPLOAD_RESYNC;
+	resume_address = address;
+	resume_limit = UINT32_MAX;
+	for (t = 0; t < extents.count; t++) {
+		if (extents.extents[t].start >= address) {
+			resume_limit = extents.extents[t].start;
+			break;
+		}
+	}
+	if (extents.count > 0 && extents.extents[extents.count - 1].end > resend_end)
+		resend_end = extents.extents[extents.count - 1].end;
+	snprintf(line, sizeof(line), "[RESEND] %08X", (unsigned int)address);
+	acm_println(line);
 }
 
 /*
@@ -127,59 +660,234 @@ void ihex_process_error(uint32_t error) {
 */
 uint32_t ihex_process_init() {
 	upload_state = UPLOAD_START;
-	printk("[READY]\n");
+	LOG_INF("[READY]\n");
 	acm_println("[READY]");
 
 	ihex_begin_read(&ihex);
-	code_memory = csopen("test.js", "w+");
+	record_open = false;
+	stage_len = 0;
+	stage_writes = 0;
+	fast_records = 0;
+	slow_records = 0;
+	resume_address = 0;
+	resume_limit = 0;
+	resume_name = false;
+	resend_end = 0;
+	resyncs = 0;
+	resync_dropped = 0;
+	extent_map_init(&extents);
+	overlap_records = 0;
+	overlap_bytes = 0;
+	pending_count = 0;
+	pending_used = 0;
+	reordered_records = 0;
+	write_address = 0;
+	accepted_records = 0;
+	accepted_bytes = 0;
+	compressed = lz_stream_enabled();
+	compressed_bytes = 0;
+	files = 0;
+	file_name[0] = '\0';
+	file_named = false;
+
+	/* Opened with the first record, which may name another file */
+	code_memory = NULL;
+	return 0;
+}
 
-	/* Error getting an id for our data storage */
-	if (!code_memory) {
-		upload_state = UPLOAD_ERROR;
-	}
+void ihex_process_progress(uint32_t *records, uint32_t *bytes) {
+	*records = accepted_records;
+	*bytes = accepted_bytes;
+}
 
-	return (!code_memory);
+bool ihex_process_is_done() {
+	return (upload_state == UPLOAD_FINISHED || upload_state == UPLOAD_ERROR);
 }
 
-uint32_t ihex_process_data(const char *buf, uint32_t len) {
-	uint32_t processed = 0;
-	while (len-- > 0) {
-		processed++;
-		char byte = *buf++;
+/*
+ * @brief Feeds one byte to the kk_ihex state machine
+ *
+ * Only used for records that do not fit in one span or that the fast path
+ * does not understand.
+ */
+static void ihex_read_slow(char byte) {
 #ifdef CONFIG_IHEX_UPLOADER_DEBUG
-		acm_write(&byte, 1);
+	acm_write(&byte, 1);
 #endif
-		if (marker) {
+	if (marker) {
+		ihex_read_byte(&ihex, byte);
+	}
+
+	/* A new record or a line end before the last one was complete */
+	if (record_open && (byte == ':' || byte == '\r' || byte == '\n')) {
+		record_open = false;
+		resume_address = ihex_first_missing();
+		trace_add(TRACE_CHECKSUM, 0xFF, resume_address);
+		ihex_process_error(resume_address);
+		if (ihex_process_is_done())
+			return;
+	}
+
+	switch (byte) {
+		case ':':
+			DBG("<MK>\n");
 			ihex_read_byte(&ihex, byte);
-		}
+			marker = true;
+			record_open = true;
+			break;
+		case '\r':
+			marker = false;
+			DBG("<CR>\n");
+			break;
+		case '\n':
+			marker = false;
+			DBG("<IF>\n");
+			break;
+	}
+}
+
+/* Value of every hex digit, 0xFF for anything else */
+static const uint8_t hex_value[256] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	   0,    1,    2,    3,    4,    5,    6,    7,    8,    9, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF,   10,   11,   12,   13,   14,   15, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF,   10,   11,   12,   13,   14,   15, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+/*
+ * @brief Decodes a whole record line in one pass
+ *
+ * Does the same as the kk_ihex state machine would for the line and
+ * keeps its address state up to date, so both paths can be mixed.
+ *
+ * @param line Characters after the ':' up to the line end
+ * @param len Number of characters
+ * @return false if the line is malformed and has to go the slow way
+ */
+static bool ihex_read_fast(const char *line, uint32_t len) {
+	const uint8_t *hex = (const uint8_t *)line;
+	uint8_t header[4];
+	uint8_t sum = 0;
+	uint8_t hi, lo, byte, type;
+	uint32_t i, count;
+
+	if (len < 10 || (len & 1))
+		return false;
 
-		switch (byte) {
-			case ':':
-				DBG("<MK>\n");
-				ihex_read_byte(&ihex, byte);
-				marker = true;
-				break;
-			case '\r':
-				marker = false;
-				DBG("<CR>\n");
-				break;
-			case '\n':
-				marker = false;
-				DBG("<IF>\n");
-				break;
+	for (i = 0; i < 4; i++, hex += 2) {
+		hi = hex_value[hex[0]];
+		lo = hex_value[hex[1]];
+		if ((hi | lo) & 0xF0)
+			return false;
+		header[i] = (hi << 4) | lo;
+		sum += header[i];
+	}
+
+	count = header[0];
+	type = header[3];
+	if (len != 10 + count * 2 || count > IHEX_LINE_MAX_LENGTH ||
+		type > IHEX_FILE_NAME_RECORD)
+		return false;
+
+	/* Data and checksum */
+	for (i = 0; i <= count; i++, hex += 2) {
+		hi = hex_value[hex[0]];
+		lo = hex_value[hex[1]];
+		if ((hi | lo) & 0xF0)
+			return false;
+		byte = (hi << 4) | lo;
+		ihex.data[i] = byte;
+		sum += byte;
+	}
+
+	ihex.address = (ihex.address & 0xFFFF0000U) | (header[1] << 8) | header[2];
+	ihex.line_length = count;
+	ihex.length = count;
+
+	if (ihex_data_read(&ihex, type, sum)) {
+		switch (type) {
+		case IHEX_EXTENDED_LINEAR_ADDRESS_RECORD:
+			ihex.address = (ihex.address & 0xFFFFU) |
+				((ihex_address_t)ihex.data[0] << 24) |
+				((ihex_address_t)ihex.data[1] << 16);
+			break;
+		case IHEX_EXTENDED_SEGMENT_ADDRESS_RECORD:
+			ihex.segment = (ihex_segment_t)((ihex.data[0] << 8) | ihex.data[1]);
+			break;
+		case IHEX_END_OF_FILE_RECORD:
+			ihex.address = 0;
+			ihex.segment = 0;
+			break;
 		}
 	}
-	return processed;
+
+	ihex.length = 0;
+	return true;
 }
 
-bool ihex_process_is_done() {
-	return (upload_state == UPLOAD_FINISHED || upload_state == UPLOAD_ERROR);
+uint32_t ihex_process_data(const struct uploader_span *span) {
+	const char *buf = span->buf;
+	const char *end = buf + span->len;
+	const char *eol;
+
+	while (buf < end && !ihex_process_is_done()) {
+		/* A record that started in the previous span */
+		if (marker) {
+			ihex_read_slow(*buf++);
+			continue;
+		}
+
+		if (*buf != ':') {
+			buf++;
+			continue;
+		}
+
+		for (eol = buf + 1; eol < end && *eol != '\r' && *eol != '\n'; eol++)
+			;
+
+		if (eol < end) {
+#ifdef CONFIG_IHEX_UPLOADER_DEBUG
+			acm_write(buf, eol - buf);
+#endif
+			if (ihex_read_fast(buf + 1, eol - buf - 1)) {
+				fast_records++;
+				buf = eol;
+				continue;
+			}
+		}
+
+		/* Not all there yet or not something we can parse in one go */
+		slow_records++;
+		ihex_read_slow(*buf++);
+	}
+
+	/* The line end of the EOF record is ours, anything after it is not */
+	if (ihex_process_is_done()) {
+		while (buf < end && (*buf == '\r' || *buf == '\n'))
+			buf++;
+	}
+
+	return buf - span->buf;
 }
 
 uint32_t ihex_process_finish() {
 	if (upload_state == UPLOAD_ERROR) {
 		printf("[Error] Callback handle error \n");
-		csclose(code_memory);
+		if (code_memory != NULL)
+			csclose(code_memory);
+		code_memory = NULL;
 
 		ashell_process_start();
 		return 1;
@@ -188,7 +896,9 @@ uint32_t ihex_process_finish() {
 	if (upload_state != UPLOAD_FINISHED)
 		return 1;
 
-	csclose(code_memory);
+	if (code_memory != NULL)
+		csclose(code_memory);
+	code_memory = NULL;
 	ihex_end_read(&ihex);
 	printf("[EOF]\n");
 	ashell_process_start();
@@ -204,6 +914,27 @@ void ihex_print_status() {
 
 	if (marker)
 		printf("[Marker]\n");
+
+	printf("[Staging] %d bytes at %d, %d writes\n",
+		(int)stage_len, (int)stage_address, (int)stage_writes);
+	printf("[Records] Fast %d Slow %d\n", (int)fast_records, (int)slow_records);
+	if (files > 0)
+		printf("[File] %s, %d in this upload\n", file_name, (int)files);
+	if (compressed)
+		printf("[LZ] In %d Out %d\n", (int)compressed_bytes,
+			(int)upload_lz.produced);
+	printf("[Resync] %d Dropped %d Resume %d%s\n", (int)resyncs,
+		(int)resync_dropped, (int)resume_address,
+		(upload_state == UPLOAD_RESYNC) ? " Waiting" : "");
+	printf("[Pending] %d records %d bytes, %d reordered\n", (int)pending_count,
+		(int)pending_used, (int)reordered_records);
+	printf("[Overlap] %d records %d bytes\n", (int)overlap_records,
+		(int)overlap_bytes);
+	for (int t = 0; t < extents.count; t++)
+		printf("[Extent] %d - %d\n", (int)extents.extents[t].start,
+			(int)extents.extents[t].end);
+	if (extents.merged > 0)
+		printf("[Extent] %d gaps merged\n", (int)extents.merged);
 }
 
 void ihex_process_start() {
@@ -215,6 +946,9 @@ void ihex_process_start() {
 	cfg.interface.is_done = ihex_process_is_done;
 	cfg.interface.close_cb = ihex_process_finish;
 	cfg.interface.process_cb = ihex_process_data;
+	cfg.interface.flush_policy = &uploader_flush_bulk;
+	cfg.interface.chunk_size = IHEX_CHUNK_SIZE;
+	cfg.interface.progress_cb = ihex_process_progress;
 	cfg.print_state = ihex_print_status;
 
 	process_set_config(&cfg);
@@ -16,6 +16,16 @@
 #ifndef __IHEX_HANDLER_H__
 #define __IHEX_HANDLER_H__
 
+/*
+ * Vendor record that names the file for the data records after it, so one
+ * session can carry several files. The data is the name in ASCII without
+ * a terminator and the address field is ignored:
+ *   :0900000673616D706C652E6A7364  "sample.js"
+ * Data before the first one goes to the file set with "set filename".
+ * Every file starts at address 0 and the upper address is reset.
+ */
+#define IHEX_FILE_NAME_RECORD 6
+
 void ihex_process_start();
 
 #endif
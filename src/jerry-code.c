@@ -47,30 +47,47 @@ void javascript_eval_code(const char *source_buffer) {
 }
 
 void javascript_run_code(const char *file_name) {
-	CODE *fp = csopen(file_name, "r");
-	if (fp == NULL)
-		return;
-
-	fs_seek(fp, 0, SEEK_END);
-	off_t len = fs_tell(fp);
-	if (len == 0) {
-		printf("Empty file\n");
+	jerry_value_t parsed_code;
+	const char *code;
+	size_t size;
+
+	/* Opening a missing file would create it */
+	ssize_t len = cslength(file_name);
+	if (len < 0) {
+		printf("File not found %s\n", file_name);
 		return;
 	}
 
-	char *buf = (char *) malloc(len);
-
-	fs_seek(fp, 0, SEEK_SET);
-	ssize_t brw = fs_read(fp, buf, len);
-	if (brw < 0) {
-		fs_close(fp);
-		printf(" Failed loading code from disk %s ", file_name);
+	CODE *fp = csopen(file_name, "r");
+	if (fp == NULL)
 		return;
-	}
 
-	/* Setup Global scope code */
-	jerry_value_t parsed_code = jerry_parse((const jerry_char_t *)buf, len, false);
-	free(buf);
+	/* Files in the flash partition are parsed where they are */
+	code = csmap(fp, &size);
+	if (code != NULL) {
+		parsed_code = jerry_parse((const jerry_char_t *)code, size, false);
+		csclose(fp);
+	} else {
+		if (len == 0) {
+			printf("Empty file\n");
+			csclose(fp);
+			return;
+		}
+
+		char *buf = (char *) malloc(len);
+
+		ssize_t brw = csread(buf, 1, len, fp);
+		csclose(fp);
+		if (brw != len) {
+			free(buf);
+			printf(" Failed loading code from disk %s ", file_name);
+			return;
+		}
+
+		/* Setup Global scope code */
+		parsed_code = jerry_parse((const jerry_char_t *)buf, len, false);
+		free(buf);
+	}
 
 	if (!jerry_value_has_error_flag(parsed_code)) {
 		/* Execute the parsed source code in the Global scope */
@@ -0,0 +1,182 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+* @file
+* @brief Streaming LZ decompression for uploads
+*
+* Sits between the transfer decoders and cswrite, the data is inflated as
+* the pieces arrive and the window is written out whenever it fills up.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz-stream.h"
+
+#define LZ_WINDOW_MASK (LZ_WINDOW_SIZE - 1)
+
+struct lz_stream upload_lz;
+
+static bool enabled;
+
+void lz_stream_set_enabled(bool enable) {
+	enabled = enable;
+}
+
+bool lz_stream_enabled(void) {
+	return enabled;
+}
+
+void lz_stream_init(struct lz_stream *lz, lz_sink_t sink) {
+	lz->sink = sink;
+	lz->header_fill = 0;
+	lz->expected = 0;
+	lz->produced = 0;
+	lz->items = 0;
+	lz->token_pending = false;
+	lz->error = false;
+	lz->pos = 0;
+	lz->flushed = 0;
+}
+
+static bool lz_flush(struct lz_stream *lz) {
+	uint32_t len = lz->pos - lz->flushed;
+
+	lz->flushed = lz->pos;
+	if (len == 0)
+		return true;
+	return lz->sink((const char *)lz->window + lz->pos - len, len);
+}
+
+/* The window is full, hand it over and start again at the beginning */
+static bool lz_wrap(struct lz_stream *lz) {
+	if (!lz_flush(lz))
+		return false;
+	lz->pos = 0;
+	lz->flushed = 0;
+	return true;
+}
+
+static bool lz_match(struct lz_stream *lz, uint8_t lo, uint8_t hi) {
+	uint32_t distance = (lo | ((hi & 0xE0) << 3)) + 1;
+	uint32_t len = (hi & 0x1F) + LZ_MIN_MATCH;
+	uint32_t from;
+
+	if (distance > lz->produced || lz->produced + len > lz->expected)
+		return false;
+
+	lz->produced += len;
+	from = (lz->pos - distance) & LZ_WINDOW_MASK;
+	while (len--) {
+		lz->window[lz->pos++] = lz->window[from];
+		from = (from + 1) & LZ_WINDOW_MASK;
+		if (lz->pos == LZ_WINDOW_SIZE && !lz_wrap(lz))
+			return false;
+	}
+	return true;
+}
+
+static bool lz_header(struct lz_stream *lz) {
+	uint8_t *header = lz->header;
+
+	if (header[0] != 'L' || header[1] != 'Z' ||
+		header[2] > LZ_WINDOW_BITS || header[3] != 0)
+		return false;
+
+	lz->expected = header[4] | (header[5] << 8) | (header[6] << 16) |
+		((uint32_t)header[7] << 24);
+	return true;
+}
+
+bool lz_stream_feed(struct lz_stream *lz, const uint8_t *buf, uint32_t len) {
+	const uint8_t *end = buf + len;
+	uint32_t run;
+
+	if (lz->error)
+		return false;
+
+	while (lz->header_fill < LZ_HEADER_SIZE && buf < end) {
+		lz->header[lz->header_fill++] = *buf++;
+		if (lz->header_fill == LZ_HEADER_SIZE && !lz_header(lz))
+			goto corrupt;
+	}
+
+	/* Second byte of a match that was split between two feeds */
+	if (lz->token_pending && buf < end) {
+		lz->token_pending = false;
+		if (!lz_match(lz, lz->token, *buf++))
+			goto corrupt;
+	}
+
+	while (buf < end) {
+		if (lz->items == 0) {
+			lz->flags = *buf++;
+			lz->items = 8;
+			continue;
+		}
+
+		if (lz->flags & 1) {
+			/* Literals are the common case, copy the whole run */
+			run = 0;
+			while (lz->items > 0 && (lz->flags & 1) && buf + run < end &&
+				lz->pos + run < LZ_WINDOW_SIZE) {
+				lz->flags >>= 1;
+				lz->items--;
+				run++;
+			}
+
+			if (lz->produced + run > lz->expected)
+				goto corrupt;
+
+			memcpy(lz->window + lz->pos, buf, run);
+			lz->pos += run;
+			lz->produced += run;
+			buf += run;
+
+			if (lz->pos == LZ_WINDOW_SIZE && !lz_wrap(lz))
+				goto corrupt;
+			continue;
+		}
+
+		lz->flags >>= 1;
+		lz->items--;
+
+		if (buf + 1 == end) {
+			lz->token = *buf++;
+			lz->token_pending = true;
+			break;
+		}
+
+		if (!lz_match(lz, buf[0], buf[1]))
+			goto corrupt;
+		buf += 2;
+	}
+
+	return true;
+
+corrupt:
+	lz->error = true;
+	return false;
+}
+
+bool lz_stream_finish(struct lz_stream *lz) {
+	if (lz->error || lz->token_pending ||
+		lz->header_fill < LZ_HEADER_SIZE || lz->produced != lz->expected)
+		return false;
+
+	return lz_flush(lz);
+}
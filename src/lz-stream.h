@@ -0,0 +1,82 @@
+/* Copyright 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LZ_STREAM_H__
+#define __LZ_STREAM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Compressed uploads, an LZSS variant that inflates in LZ_WINDOW_SIZE
+ * bytes of RAM and nothing else:
+ *
+ *   header  'L' 'Z' window_bits 0 and the inflated size, 32 bit little endian
+ *   groups  A flag byte, then 8 items. Flag bit set (LSB first) for a
+ *           literal byte, clear for a 2 byte match:
+ *             byte 0  distance - 1, low 8 bits
+ *             byte 1  distance - 1, high 3 bits << 5 | length - 3
+ *
+ * Distances go up to the window size and lengths from 3 to 34. The window
+ * doubles as the output buffer, so the sink gets the data in pieces of up
+ * to LZ_WINDOW_SIZE bytes.
+ */
+#define LZ_WINDOW_BITS   11
+#define LZ_WINDOW_SIZE   (1 << LZ_WINDOW_BITS)
+#define LZ_HEADER_SIZE   8
+#define LZ_MIN_MATCH     3
+#define LZ_MAX_MATCH     (LZ_MIN_MATCH + 31)
+
+/* Takes inflated data, false stops the stream */
+typedef bool(*lz_sink_t)(const char *buf, uint32_t len);
+
+struct lz_stream {
+	lz_sink_t sink;
+	uint8_t header[LZ_HEADER_SIZE];
+	uint32_t header_fill;
+	uint32_t expected;        /* Size from the header */
+	uint32_t produced;
+	uint8_t flags;            /* Flag byte of the current group */
+	uint8_t items;            /* Items left in the group */
+	uint8_t token;            /* First byte of a match split between feeds */
+	bool token_pending;
+	bool error;
+	uint32_t pos;             /* Next write in the window */
+	uint32_t flushed;         /* Window data before this went to the sink */
+	uint8_t window[LZ_WINDOW_SIZE];
+};
+
+/* Decoder for the uploaders, only one of them runs at a time */
+extern struct lz_stream upload_lz;
+
+void lz_stream_init(struct lz_stream *lz, lz_sink_t sink);
+
+/*
+ * @brief Inflates the next piece of the stream
+ * @return false on corrupt data or if the sink failed
+ */
+bool lz_stream_feed(struct lz_stream *lz, const uint8_t *buf, uint32_t len);
+
+/*
+ * @brief Hands the rest of the window to the sink
+ * @return false unless exactly the size in the header was produced
+ */
+bool lz_stream_finish(struct lz_stream *lz);
+
+/* Uploads are compressed, set with "set compress" */
+void lz_stream_set_enabled(bool enabled);
+bool lz_stream_enabled(void);
+
+#endif
@@ -25,6 +25,7 @@
 #include "uart-uploader.h"
 #include "ihex-handler.h"
 #include "acm-shell.h"
+#include "uploader-trace.h"
 
 #define CONFIG_USE_JS_SHELL
 #define CONFIG_USE_IHEX_UPLOADER
@@ -97,10 +98,10 @@ static int shell_acm_command(int argc, char *argv[]) {
 	if (!strcmp(cmd, "print")) {
 		for (int t = 2; t < argc; t++) {
 			if (t > 2)
-				acm_write(" ", 2);
+				acm_write(" ", 1);
 			acm_write(argv[t], strlen(argv[t]));
 		}
-		acm_write("\r\n", 3);
+		acm_write("\r\n", 2);
 		return 0;
 	}
 
@@ -108,6 +109,16 @@ static int shell_acm_command(int argc, char *argv[]) {
 		uart_print_status();
 		return 0;
 	}
+
+	if (!strcmp(cmd, "dump")) {
+		uart_dump_status();
+		return 0;
+	}
+
+	if (!strcmp(cmd, "trace")) {
+		trace_print();
+		return 0;
+	}
 	printf("Command unknown\n");
 	return 0;
 } /* shell_acm_command */
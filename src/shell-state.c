@@ -26,20 +26,35 @@
 #include <string.h>
 #include <atomic.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <misc/printk.h>
 #include <ctype.h>
 
 #include "uart-uploader.h"
 #include "acm-shell.h"
 #include "ihex-handler.h"
+#include "binary-handler.h"
+#include "lz-stream.h"
 #include "code-memory.h"
+#include "code-meta.h"
 #include "shell-state.h"
 #include "jerry-code.h"
 
 #define CMD_TRANSFER_IHEX  "ihex"
 #define CMD_TRANSFER_RAW   "raw"
+#define CMD_TRANSFER_BINARY "binary"
 #define CMD_TRANSFER       "transfer"
 #define CMD_FILENAME       "filename"
+#define CMD_ACK            "ack"
+#define CMD_ACK_RECORDS    "records"
+#define CMD_ACK_BYTES      "bytes"
+#define CMD_ACK_OFF        "off"
+#define CMD_COMPRESS       "compress"
+#define CMD_COMPRESS_LZ    "lz"
+#define CMD_COMPRESS_OFF   "off"
+#define CMD_STORAGE        "storage"
+#define CMD_STORAGE_FAT    "fat"
+#define CMD_STORAGE_FLASH  "flash"
 #define CMD_AT             "at"
 #define CMD_LS             "ls"
 #define CMD_RUN            "run"
@@ -54,6 +69,9 @@
 #define CMD_CAT            "cat"
 #define CMD_EVAL           "eval"
 #define CMD_DU             "du"
+#define CMD_CRC            "crc"
+#define CMD_CRC_READ       "-r"
+#define CMD_STATS          "stats"
 
 /*
  * Contains the pointer to the memory where the code will be uploaded
@@ -88,14 +106,13 @@ const char MSG_IMMEDIATE_MODE[] = "Ready to evaluate JavaScript.\r\n" \
 "\tCtrl+X or Ctrl+C to return to shell.";
 
 const char READY_FOR_IHEX_DATA[] = "[BEGIN IHEX]";
+const char READY_FOR_BINARY_DATA[] = "[BEGIN BINARY]";
 const char hex_prompt[] = "HEX> ";
 const char raw_prompt[] = ANSI_FG_YELLOW "RAW> " ANSI_FG_RESTORE;
 const char eval_prompt[] = ANSI_FG_GREEN "js> " ANSI_FG_RESTORE;
 
 #define MAX_ARGUMENT_SIZE 32
 
-#define READ_BUFFER_SIZE 4
-
 #ifndef CONFIG_IHEX_UPLOADER_DEBUG
 #define DBG(...) { ; }
 #else
@@ -120,6 +137,44 @@ const char *ashell_get_filename() {
 	return shell.filename;
 }
 
+/* The flash partition has no directories, just the files in its slots */
+static int32_t ashell_list_flash() {
+	const char *name;
+	uint32_t size;
+	int slot;
+
+	for (slot = 0; slot < CONFIG_CODE_FLASH_SLOTS; slot++) {
+		if (code_flash_stat(slot, &name, &size) == 0)
+			printf("%5lu %s\n", (unsigned long)size, name);
+	}
+	return 0;
+}
+
+/* The root directory as code-memory last left it */
+static int32_t ashell_list_meta() {
+	const struct code_meta *meta;
+	const char *p;
+	uint32_t t;
+
+	printf(ANSI_FG_LIGHT_BLUE "      .\n      ..\n" ANSI_FG_RESTORE);
+	for (t = 0; t < CONFIG_CODE_META_ENTRIES; t++) {
+		meta = code_meta_entry(t);
+		if (meta == NULL)
+			continue;
+
+		if (meta->flags & CODE_META_DIR) {
+			printf(ANSI_FG_LIGHT_BLUE "%s\n" ANSI_FG_RESTORE, meta->name);
+			continue;
+		}
+
+		printf("%5lu ", (unsigned long)meta->size);
+		for (p = meta->name; *p; p++)
+			putchar(tolower((int)*p));
+		putchar('\n');
+	}
+	return 0;
+}
+
 int32_t ashell_list_dir(const char *buf, uint32_t len, char *arg) {
 	int res;
 	ZDIR dp;
@@ -140,6 +195,12 @@ int32_t ashell_list_dir(const char *buf, uint32_t len, char *arg) {
 		filename = arg;
 	}
 
+	if (code_memory_get_storage() == CODE_STORAGE_FLASH)
+		return ashell_list_flash();
+
+	if (filename[0] == '\0' && code_meta_complete())
+		return ashell_list_meta();
+
 	res = fs_opendir(&dp, filename);
 	if (res) {
 		printf("Error opening dir[%d]\n", res);
@@ -172,11 +233,11 @@ int32_t ashell_list_dir(const char *buf, uint32_t len, char *arg) {
 }
 
 int32_t ashell_print_file(const char *buf, uint32_t len, char *arg) {
-	char data[READ_BUFFER_SIZE];
+	const char *data;
 	const char *filename;
 	CODE *file;
 	uint32_t arg_len;
-	size_t count;
+	ssize_t count, t, end;
 
 	if (len > MAX_FILENAME_SIZE) {
 		acm_println(ERROR_EXCEDEED_SIZE);
@@ -190,10 +251,15 @@ int32_t ashell_print_file(const char *buf, uint32_t len, char *arg) {
 		filename = arg;
 	}
 
-	if (!csexist(filename)) {
+	ssize_t size = cslength(filename);
+	if (size < 0) {
 		printf(ERROR_FILE_NOT_FOUND);
 		return RET_ERROR;
 	}
+	if (size == 0) {
+		acm_println("Empty file");
+		return RET_OK;
+	}
 
 	printk("Open [%s]\n", filename);
 	file = csopen(filename, "r");
@@ -204,23 +270,19 @@ int32_t ashell_print_file(const char *buf, uint32_t len, char *arg) {
 		return RET_ERROR;
 	}
 
-	ssize_t size = cssize(file);
-	if (size == 0) {
-		acm_println("Empty file");
-		csclose(file);
-		return RET_OK;
-	}
-
-	csseek(file, 0, SEEK_SET);
-	do {
-		count = csread(data, 4, 1, file);
-		for (int t = 0; t < count; t++) {
-			if (data[t] == '\n' || data[t] == '\r')
+	while ((count = cspeek(file, &data)) > 0) {
+		/* Runs between line ends go out in one write */
+		for (t = 0; t < count; t = end + 1) {
+			for (end = t; end < count; end++) {
+				if (data[end] == '\n' || data[end] == '\r')
+					break;
+			}
+			acm_write(&data[t], end - t);
+			if (end < count)
 				acm_write("\r\n", 2);
-			else
-				acm_writec(data[t]);
 		}
-	} while (count > 0);
+		csskip(file, count);
+	}
 
 	csclose(file);
 	return RET_OK;
@@ -263,37 +325,102 @@ int32_t ashell_disk_usage(const char *buf, uint32_t len, char *arg) {
 		filename = arg;
 	}
 
-	CODE *file = csopen(arg, "r");
-	if (file == NULL) {
+	ssize_t size = cslength(filename);
+	if (size < 0) {
 		acm_println(ERROR_FILE_NOT_FOUND);
 		return RET_ERROR;
 	}
 
-	ssize_t size = cssize(file);
-	csclose(file);
-
 	printf("%5ld %s\n", size, filename);
 	return RET_OK;
 }
 
+/*
+ * @brief Prints "[CRC] <crc> <size>" for a file
+ *
+ * Same CRC-32 as the binary frames, so a host can check an upload without
+ * reading the file back.
+ */
+int32_t ashell_file_crc(const char *buf, uint32_t len, char *arg) {
+	const char *data;
+	char line[32];
+	const char *filename;
+	uint32_t arg_len;
+	uint32_t crc = 0;
+	ssize_t count = 0;
+	ssize_t size;
+	bool read_back = false;
+	CODE *file;
+
+	buf = ashell_get_next_arg_s(buf, len, arg, MAX_ARGUMENT_SIZE, &arg_len);
+	if (!strcmp(CMD_CRC_READ, arg)) {
+		read_back = true;
+		buf = ashell_get_next_arg_s(buf, len, arg, MAX_ARGUMENT_SIZE, &arg_len);
+	}
+	if (arg_len == 0) {
+		filename = shell.filename;
+	} else {
+		filename = arg;
+	}
+
+	size = cslength(filename);
+	if (size < 0) {
+		acm_println(ERROR_FILE_NOT_FOUND);
+		return RET_ERROR;
+	}
+
+	/*
+	 * Files written through code-memory already have theirs, worked out
+	 * from the data that was written. -r reads what the storage holds.
+	 */
+	if (read_back || csgethash(filename, &crc) != 0) {
+		file = csopen(filename, "r");
+		if (!file) {
+			acm_println(ERROR_FILE_NOT_FOUND);
+			return RET_ERROR;
+		}
+
+		size = 0;
+		while ((count = cspeek(file, &data)) > 0) {
+			crc = binary_crc32(crc, data, count);
+			size += count;
+			csskip(file, count);
+		}
+		csclose(file);
+
+		/* A partial CRC would look like a file with the wrong data */
+		if (count < 0) {
+			acm_println("[ERR] Read error");
+			return RET_ERROR;
+		}
+		cssethash(filename, size, crc);
+	}
+
+	snprintf(line, sizeof(line), "[CRC] %08X %d", (unsigned int)crc, (int)size);
+	acm_println(line);
+	return RET_OK;
+}
+
 int32_t ashell_help(const char *buf, uint32_t len) {
 	acm_println("TODO: Read help file!");
 	return RET_OK;
 }
 
 int32_t ashell_set_filename(const char *buf, uint32_t len) {
+	char filename[MAX_ARGUMENT_SIZE];
 	uint32_t arg_len;
 
-	if (len > MAX_FILENAME_SIZE) {
-		acm_println(ERROR_EXCEDEED_SIZE);
-		return RET_ERROR;
-	}
-
-	buf = ashell_get_next_arg_s(buf, len, shell.filename, MAX_FILENAME_SIZE, &arg_len);
+	/* The line still has the spaces before the name, check the name */
+	buf = ashell_get_next_arg_s(buf, len, filename, MAX_ARGUMENT_SIZE, &arg_len);
 	if (arg_len == 0) {
 		acm_println(ERROR_NOT_ENOUGH_ARGUMENTS);
 		return RET_ERROR;
 	}
+	if (strlen(filename) >= MAX_FILENAME_SIZE) {
+		acm_println(ERROR_EXCEDEED_SIZE);
+		return RET_ERROR;
+	}
+	strcpy(shell.filename, filename);
 
 	acm_print("Filename [");
 	acm_print(shell.filename);
@@ -403,6 +530,11 @@ int32_t ashell_read_data(const char *buf, uint32_t len, char *arg) {
 		acm_println(READY_FOR_IHEX_DATA);
 		ashell_process_close();
 	}
+
+	if (shell.state_flags & kShellTransferSnapshot) {
+		acm_println(READY_FOR_BINARY_DATA);
+		ashell_process_switch(binary_process_start);
+	}
 	return RET_OK;
 }
 
@@ -430,14 +562,98 @@ int32_t ashell_set_transfer_state(const char *buf, uint32_t len, char *arg) {
 	if (!strcmp(CMD_TRANSFER_RAW, arg)) {
 		acm_set_prompt(NULL);
 		shell.state_flags |= kShellTransferRaw;
-		shell.state_flags &= ~kShellTransferIhex;
+		shell.state_flags &= ~(kShellTransferIhex | kShellTransferSnapshot);
 		return RET_OK;
 	}
 
 	if (!strcmp(CMD_TRANSFER_IHEX, arg)) {
 		acm_set_prompt(hex_prompt);
 		shell.state_flags |= kShellTransferIhex;
-		shell.state_flags &= ~kShellTransferRaw;
+		shell.state_flags &= ~(kShellTransferRaw | kShellTransferSnapshot);
+		return RET_OK;
+	}
+
+	if (!strcmp(CMD_TRANSFER_BINARY, arg)) {
+		acm_set_prompt(NULL);
+		shell.state_flags |= kShellTransferSnapshot;
+		shell.state_flags &= ~(kShellTransferRaw | kShellTransferIhex);
+		return RET_OK;
+	}
+
+	return RET_UNKNOWN;
+}
+
+int32_t ashell_set_ack(const char *buf, uint32_t len, char *arg) {
+	enum uploader_ack_mode mode;
+	uint32_t arg_len;
+
+	buf = ashell_get_next_arg_s(buf, len, arg, MAX_ARGUMENT_SIZE, &arg_len);
+	if (arg_len == 0) {
+		acm_println(ERROR_NOT_ENOUGH_ARGUMENTS);
+		return -1;
+	}
+	len -= arg_len;
+
+	if (!strcmp(CMD_ACK_OFF, arg)) {
+		uploader_set_ack(UPLOADER_ACK_OFF, 0);
+		return RET_OK;
+	}
+
+	if (!strcmp(CMD_ACK_RECORDS, arg))
+		mode = UPLOADER_ACK_RECORDS;
+	else if (!strcmp(CMD_ACK_BYTES, arg))
+		mode = UPLOADER_ACK_BYTES;
+	else
+		return RET_UNKNOWN;
+
+	buf = ashell_get_next_arg_s(buf, len, arg, MAX_ARGUMENT_SIZE, &arg_len);
+	if (arg_len == 0) {
+		acm_println(ERROR_NOT_ENOUGH_ARGUMENTS);
+		return -1;
+	}
+
+	uploader_set_ack(mode, strtoul(arg, NULL, 10));
+	return RET_OK;
+}
+
+int32_t ashell_set_compress(const char *buf, uint32_t len, char *arg) {
+	uint32_t arg_len;
+
+	buf = ashell_get_next_arg_s(buf, len, arg, MAX_ARGUMENT_SIZE, &arg_len);
+	if (arg_len == 0) {
+		acm_println(ERROR_NOT_ENOUGH_ARGUMENTS);
+		return -1;
+	}
+
+	if (!strcmp(CMD_COMPRESS_LZ, arg)) {
+		lz_stream_set_enabled(true);
+		return RET_OK;
+	}
+
+	if (!strcmp(CMD_COMPRESS_OFF, arg)) {
+		lz_stream_set_enabled(false);
+		return RET_OK;
+	}
+
+	return RET_UNKNOWN;
+}
+
+int32_t ashell_set_storage(const char *buf, uint32_t len, char *arg) {
+	uint32_t arg_len;
+
+	buf = ashell_get_next_arg_s(buf, len, arg, MAX_ARGUMENT_SIZE, &arg_len);
+	if (arg_len == 0) {
+		acm_println(ERROR_NOT_ENOUGH_ARGUMENTS);
+		return -1;
+	}
+
+	if (!strcmp(CMD_STORAGE_FAT, arg)) {
+		code_memory_set_storage(CODE_STORAGE_FAT);
+		return RET_OK;
+	}
+
+	if (!strcmp(CMD_STORAGE_FLASH, arg)) {
+		code_memory_set_storage(CODE_STORAGE_FLASH);
 		return RET_OK;
 	}
 
@@ -459,6 +675,15 @@ int32_t ashell_set_state(const char *buf, uint32_t len, char *arg) {
 	} else
 		if (!strcmp(CMD_FILENAME, arg)) {
 			return ashell_set_filename(buf, len);
+		} else
+		if (!strcmp(CMD_ACK, arg)) {
+			return ashell_set_ack(buf, len, arg);
+		} else
+		if (!strcmp(CMD_COMPRESS, arg)) {
+			return ashell_set_compress(buf, len, arg);
+		} else
+		if (!strcmp(CMD_STORAGE, arg)) {
+			return ashell_set_storage(buf, len, arg);
 		}
 
 	return RET_UNKNOWN;
@@ -483,6 +708,9 @@ int32_t ashell_get_state(const char *buf, uint32_t len, char *arg) {
 		if (shell.state_flags & kShellTransferIhex)
 			acm_println("Ihex");
 
+		if (shell.state_flags & kShellTransferSnapshot)
+			acm_println("Binary");
+
 		return RET_OK;
 	}
 
@@ -588,6 +816,15 @@ int32_t ashell_main_state(const char *buf, uint32_t len) {
 		return ashell_disk_usage(buf, len, arg);
 	}
 
+	if (!strcmp(CMD_CRC, arg)) {
+		return ashell_file_crc(buf, len, arg);
+	}
+
+	if (!strcmp(CMD_STATS, arg)) {
+		uart_dump_status();
+		return RET_OK;
+	}
+
 #ifdef CONFIG_SHELL_UPLOADER_DEBUG
 	printk("%u [%s] \r\n", arg_len, arg);
 
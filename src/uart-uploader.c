@@ -53,6 +53,8 @@
 #include "jerry-code.h"
 
 #include "uart-uploader.h"
+#include "uploader-timing.h"
+#include "uploader-trace.h"
 #include "ihex/kk_ihex_read.h"
 
 #ifndef CONFIG_IHEX_UPLOADER_DEBUG
@@ -88,8 +90,66 @@ const char *system_get_prompt() {
 	return system_prompt;
 }
 
+/* Amount of data handed to the process callback in one call, for the
+ * processes that don't ask for anything else.
+ */
 #define MAX_LINE_LEN 64
-#define FIFO_CACHE 2
+
+/*
+ * Build options, plain defines with the defaults below. Override them with
+ * -DCONFIG_UART_UPLOADER_...=value in the build flags. Define
+ * CONFIG_UART_UPLOADER_XON_XOFF to send XOFF/XON to the host when the
+ * receive ring crosses its watermarks.
+ */
+
+/* Largest chunk a process can ask for, at most half of the receive ring */
+#ifndef CONFIG_UART_UPLOADER_MAX_CHUNK_SIZE
+#define CONFIG_UART_UPLOADER_MAX_CHUNK_SIZE 512
+#endif
+
+#define MAX_CHUNK_SIZE CONFIG_UART_UPLOADER_MAX_CHUNK_SIZE
+
+/* Size of the receive ring, it has to be a power of two */
+#ifndef CONFIG_UART_UPLOADER_RX_RING_SIZE
+#define CONFIG_UART_UPLOADER_RX_RING_SIZE 1024
+#endif
+
+#define RX_RING_SIZE CONFIG_UART_UPLOADER_RX_RING_SIZE
+#define RX_RING_MASK (RX_RING_SIZE - 1)
+
+#if (RX_RING_SIZE & RX_RING_MASK) != 0
+#error "CONFIG_UART_UPLOADER_RX_RING_SIZE must be a power of two"
+#endif
+
+#if MAX_CHUNK_SIZE > RX_RING_SIZE / 2
+#error "CONFIG_UART_UPLOADER_MAX_CHUNK_SIZE must fit twice in the receive ring"
+#endif
+
+/* Receive flow control, stop reading above the high watermark and start
+ * again once the task has brought the ring below the low watermark.
+ */
+#define RX_HIGH_WATER (RX_RING_SIZE * 3 / 4)
+#define RX_LOW_WATER  (RX_RING_SIZE / 4)
+
+/* Software flow control characters */
+#define ASCII_XON  0x11
+#define ASCII_XOFF 0x13
+
+/* Size of the transmit ring, it has to be a power of two */
+#ifndef CONFIG_UART_UPLOADER_TX_RING_SIZE
+#define CONFIG_UART_UPLOADER_TX_RING_SIZE 512
+#endif
+
+#define TX_RING_SIZE CONFIG_UART_UPLOADER_TX_RING_SIZE
+#define TX_RING_MASK (TX_RING_SIZE - 1)
+
+#if (TX_RING_SIZE & TX_RING_MASK) != 0
+#error "CONFIG_UART_UPLOADER_TX_RING_SIZE must be a power of two"
+#endif
+
+/* Output combiner in front of the transmit ring */
+#define OUT_LINE_SIZE 128
+#define OUT_IDLE_MS 10
 
 /* Configuration of the callbacks to be called */
 static struct uploader_cfg_data uploader_config = {
@@ -100,68 +160,339 @@ static struct uploader_cfg_data uploader_config = {
 		.close_cb = NULL,
 		.process_cb = NULL,
 		.error_cb = NULL,
-		.is_done = NULL
+		.is_done = NULL,
+		.flush_policy = NULL,
+		.chunk_size = 0,
+		.progress_cb = NULL
 	},
 	.print_state = NULL
 };
 
-struct uart_uploader_input {
-	int _unused;
-	char line[MAX_LINE_LEN + 1];
+/**************************** ACK WINDOW **********************************/
+
+static enum uploader_ack_mode ack_mode = UPLOADER_ACK_OFF;
+static uint32_t ack_window;
+
+/* Count in the last ack of the current process, acks sent since clear */
+static uint32_t ack_last;
+static uint32_t ack_count;
+
+static const char *const ack_mode_names[] = { "off", "records", "bytes" };
+
+void uploader_set_ack(enum uploader_ack_mode mode, uint32_t window) {
+	ack_mode = (window > 0) ? mode : UPLOADER_ACK_OFF;
+	ack_window = window;
+}
+
+/*
+ * @brief Sends "[ACK] <count>" if the window moved far enough
+ *
+ * Called by the runner after every span, so acks are cumulative and
+ * never more than one per span.
+ */
+static void uploader_ack(bool final) {
+	uint32_t records = 0;
+	uint32_t bytes = 0;
+	uint32_t count;
+	char token[24];
+
+	if (ack_mode == UPLOADER_ACK_OFF ||
+		uploader_config.interface.progress_cb == NULL)
+		return;
+
+	uploader_config.interface.progress_cb(&records, &bytes);
+	count = (ack_mode == UPLOADER_ACK_RECORDS) ? records : bytes;
+
+	if (count == ack_last || (!final && count - ack_last < ack_window))
+		return;
+
+	ack_last = count;
+	ack_count++;
+	snprintf(token, sizeof(token), "[ACK] %u", (unsigned int)count);
+	acm_println(token);
+}
+
+/**************************** FLUSH POLICY **********************************/
+
+struct uploader_flush_policy uploader_flush_interactive = {
+	.name = "interactive",
+	.min_batch = 1,
+	.max_hold_ms = 0,
+	.flush_on_ctrl = true
+};
+
+struct uploader_flush_policy uploader_flush_bulk = {
+	.name = "bulk",
+	.min_batch = RX_RING_SIZE / 4,
+	.max_hold_ms = 20,
+	.flush_on_ctrl = false
 };
 
-static struct nano_fifo avail_queue;
-static struct nano_fifo data_queue;
-static bool uart_process_done = false;
-static uint8_t fifo_size = 0;
-static uint8_t max_fifo_size = 0;
-
-uint32_t alloc_count = 0;
-uint32_t free_count = 0;
-
-struct uart_uploader_input *fifo_get_isr_buffer() {
-	void *data = nano_isr_fifo_get(&avail_queue, TICKS_NONE);
-	if (!data) {
-		data = (void *)malloc(sizeof(struct uart_uploader_input));
-		memset(data, '-', sizeof(struct uart_uploader_input));
-		alloc_count++;
-		fifo_size++;
-		if (fifo_size > max_fifo_size)
-			max_fifo_size = fifo_size;
+/* Policy of the running process, the ISR reads it so it is swapped as a
+ * single pointer write from the task when a process starts.
+ */
+static struct uploader_flush_policy *volatile rx_policy = &uploader_flush_interactive;
+
+/**************************** TX RING **********************************/
+
+/*
+ * Ring with the data waiting to be sent.
+ *
+ * Writers append at tx_head with the interrupts locked, since printf can
+ * be called from any task. The TX ready interrupt drains from tx_tail.
+ * While tx_busy is set the interrupt is enabled and owns the transfer,
+ * otherwise the next writer has to start it.
+ */
+static char tx_ring[TX_RING_SIZE];
+static atomic_t tx_head = 0;
+static atomic_t tx_tail = 0;
+static atomic_t tx_busy = 0;
+
+/* Writers waiting for space or for the ring to drain sleep here. The
+ * uploader and a console task printing the status can both be waiting.
+ */
+static struct nano_sem tx_sem;
+static atomic_t tx_writers_waiting = 0;
+
+static enum acm_tx_policy tx_policy = ACM_TX_BLOCK;
+
+static uint32_t tx_high_water = 0;
+static uint32_t tx_drop_count = 0;
+static uint32_t tx_truncate_count = 0;
+
+/*
+ * Characters written one by one (printf, echo, cat) are combined here
+ * before going into the transmit ring, so they don't end up as one USB
+ * transfer each. The line is sent on a new line, when it is full, before
+ * any acm_write and when nothing has been written for OUT_IDLE_MS.
+ * The idle time is enforced by the uploader task while it waits for data.
+ */
+static char out_line[OUT_LINE_SIZE];
+static uint32_t out_len = 0;
+static uint32_t out_tick = 0;
+
+static uint32_t out_flush_count = 0;
+
+static inline uint32_t tx_ring_used(void) {
+	return (uint32_t)atomic_get(&tx_head) - (uint32_t)atomic_get(&tx_tail);
+}
+
+/*
+ * @brief Sends the next contiguous span of the ring
+ *
+ * Called from the TX ready interrupt or with the interrupts locked.
+ */
+static void tx_ring_drain(struct device *dev) {
+	uint32_t tail = (uint32_t)atomic_get(&tx_tail);
+	uint32_t used = (uint32_t)atomic_get(&tx_head) - tail;
+	uint32_t offset = tail & TX_RING_MASK;
+	uint32_t len = TX_RING_SIZE - offset;
+	atomic_val_t waiters;
+	int written;
+
+	if (used == 0) {
+		uart_irq_tx_disable(dev);
+		atomic_set(&tx_busy, 0);
+	} else {
+		if (len > used)
+			len = used;
+
+		written = uart_fifo_fill(dev, &tx_ring[offset], len);
+		if (written > 0)
+			atomic_add(&tx_tail, written);
 	}
-	return (struct uart_uploader_input *) data;
+
+	for (waiters = atomic_set(&tx_writers_waiting, 0); waiters > 0; waiters--)
+		nano_isr_sem_give(&tx_sem);
+}
+
+/**************************** RX RING **********************************/
+
+/*
+ * Single producer / single consumer ring between the interrupt handler and
+ * the uploader task.
+ *
+ * The ISR is the only one that moves rx_head and the task is the only one
+ * that moves rx_tail. Both are free running counters that get masked when
+ * indexing the buffer, so head - tail is always the number of bytes pending
+ * and a full ring can be told apart from an empty one.
+ */
+static char rx_ring[RX_RING_SIZE];
+static atomic_t rx_head = 0;
+static atomic_t rx_tail = 0;
+
+/*
+ * Data between rx_tail and rx_flush has been handed over to the task,
+ * data between rx_flush and rx_head is being held by the flush policy.
+ * It is moved by the ISR and by the task when the hold time expires, the
+ * later does it with the interrupts locked.
+ */
+static atomic_t rx_flush = 0;
+
+/* When the oldest byte still held arrived, in cycles and ticks */
+static uint32_t rx_hold_cycle = 0;
+static uint32_t rx_hold_tick = 0;
+
+/* When the oldest byte of the data handed over arrived */
+static uint32_t rx_chunk_cycle = 0;
+
+/* The task sleeps here when there is nothing left to process */
+static struct nano_sem rx_sem;
+
+/* Set by the task right before sleeping, the ISR will only signal then */
+static atomic_t rx_consumer_waiting = 0;
+
+/* The ring went over the high watermark and we stopped reading from the
+ * driver. The driver NAKs the bulk OUT endpoint once its own buffer is full.
+ */
+static atomic_t rx_paused = 0;
+static uint32_t rx_throttle_count = 0;
+static uint32_t rx_xoff_failed = 0;
+
+/* Occupancy accounting, only updated from the ISR */
+static uint32_t rx_high_water = 0;
+
+static inline uint32_t rx_ring_used(void) {
+	return (uint32_t)atomic_get(&rx_head) - (uint32_t)atomic_get(&rx_tail);
+}
+
+/* Bytes already handed over to the task */
+static inline uint32_t rx_ring_ready(void) {
+	return (uint32_t)atomic_get(&rx_flush) - (uint32_t)atomic_get(&rx_tail);
 }
 
-void fifo_recycle_buffer(struct uart_uploader_input *data) {
-	if (fifo_size > FIFO_CACHE) {
-		free(data);
-		fifo_size--;
-		free_count++;
+/*
+ * @brief Returns the contiguous readable span at the tail of the ring
+ *
+ * Data that wraps around the end of the ring is returned on the next call.
+ */
+static uint32_t rx_ring_peek(char **ptr) {
+	uint32_t tail = (uint32_t)atomic_get(&rx_tail);
+	uint32_t used = (uint32_t)atomic_get(&rx_flush) - tail;
+	uint32_t offset = tail & RX_RING_MASK;
+	uint32_t len = RX_RING_SIZE - offset;
+
+	if (len > used)
+		len = used;
+
+	*ptr = &rx_ring[offset];
+	return len;
+}
+
+static void rx_ring_consume(uint32_t len) {
+	atomic_add(&rx_tail, len);
+}
+
+/* Joins data handed back at the end of the ring with the data at the start */
+static char rx_bounce[MAX_CHUNK_SIZE];
+
+/* Chunk size of the running process */
+static uint32_t rx_chunk_size = MAX_LINE_LEN;
+
+/*
+ * @brief Lends the next span of received data to the process
+ *
+ * The span points straight into the ring. Only when the process handed
+ * back data that reaches the end of the ring, that data and the start of
+ * the ring are copied together so the process gets to see more of it.
+ */
+static void rx_span_get(struct uploader_span *span, uint32_t handed_back) {
+	char *buf;
+	uint32_t tail = (uint32_t)atomic_get(&rx_tail);
+	uint32_t avail = (uint32_t)atomic_get(&rx_flush) - tail;
+	uint32_t len = rx_ring_peek(&buf);
+
+	span->token = tail;
+
+	if (handed_back > 0 && len == handed_back && avail > len) {
+		if (avail > rx_chunk_size)
+			avail = rx_chunk_size;
+
+		memcpy(rx_bounce, buf, len);
+		memcpy(rx_bounce + len, rx_ring, avail - len);
+		span->buf = rx_bounce;
+		span->len = avail;
 		return;
 	}
-	nano_task_fifo_put(&avail_queue, data);
+
+	if (len > rx_chunk_size)
+		len = rx_chunk_size;
+
+	span->buf = buf;
+	span->len = len;
 }
 
-void uart_clear(void) {
-	void *data = NULL;
-	do {
-		if (data != NULL)
-			free(data);
-		data = nano_fifo_get(&avail_queue, TICKS_NONE);
-	} while (data);
+/*
+ * @brief Hands over everything received up to head to the task
+ *
+ * Called from the ISR or from the task with the interrupts locked.
+ */
+static void rx_flush_to(uint32_t head) {
+	struct uploader_flush_policy *policy = rx_policy;
+	uint32_t flush = (uint32_t)atomic_get(&rx_flush);
+
+	if (head == flush)
+		return;
 
-	do {
-		if (data != NULL)
-			free(data);
-		data = nano_fifo_get(&data_queue, TICKS_NONE);
-	} while (data);
+	policy->stats.chunks++;
+	policy->stats.bytes += head - flush;
+
+	rx_chunk_cycle = rx_hold_cycle;
+	atomic_set(&rx_flush, head);
+}
+
+static void flush_stats_reset(struct uploader_flush_policy *policy) {
+	memset(&policy->stats, 0, sizeof(policy->stats));
+}
+
+void uart_clear(void) {
+	unsigned int key = irq_lock();
+
+	/* Drop everything that is waiting to be processed */
+	rx_flush_to(atomic_get(&rx_head));
+	atomic_set(&rx_tail, atomic_get(&rx_head));
+	irq_unlock(key);
+
+	rx_high_water = 0;
+	rx_throttle_count = 0;
+	rx_xoff_failed = 0;
+	tx_high_water = 0;
+	tx_drop_count = 0;
+	tx_truncate_count = 0;
+	out_flush_count = 0;
+	ack_count = 0;
+	flush_stats_reset(&uploader_flush_interactive);
+	flush_stats_reset(&uploader_flush_bulk);
+	code_memory_reset_status();
+	timing_reset();
+	trace_reset();
 }
 
 /**************************** UART CAPTURE **********************************/
 
 static struct device *dev_upload;
 
-static volatile bool data_transmitted;
+static uint32_t tx_ring_put(const char *buf, uint32_t len);
+
+/*
+ * @brief Tells the host to stop or to carry on sending
+ */
+static void rx_send_flow(char byte) {
+#ifdef CONFIG_UART_UPLOADER_XON_XOFF
+	if (tx_ring_put(&byte, 1) == 0)
+		rx_xoff_failed++;
+#endif
+}
+
+/*
+ * @brief Stops reading from the driver until the task catches up
+ */
+static void rx_throttle(struct device *dev) {
+	uart_irq_rx_disable(dev);
+	atomic_set(&rx_paused, 1);
+	rx_throttle_count++;
+	rx_send_flow(ASCII_XOFF);
+}
 
 uint32_t bytes_received = 0;
 uint32_t bytes_processed = 0;
@@ -189,95 +520,192 @@ enum {
 	UART_TERMINATED
 };
 
-static struct uart_uploader_input *data = NULL;
-static uint32_t tail = 0;
-static char *buf;
+/*
+ * @brief Checks the data just read for anything that requires a flush
+ */
+static bool rx_has_ctrl(const char *buf, uint32_t len) {
+	while (len-- > 0) {
+		char byte = *buf++;
+		if (byte >= CTRL_START && byte <= CTRL_END)
+			return true;
+	}
+	return false;
+}
 
 static void interrupt_handler(struct device *dev) {
-	char byte;
-
+	struct uploader_flush_policy *policy = rx_policy;
+	uint32_t start = timing_start();
+	uint32_t head_start = (uint32_t)atomic_get(&rx_head);
 	uint32_t bytes_read = 0;
-	uint32_t len = 0;
+	uint32_t head, offset, space, len;
+	bool flush = false;
+	bool hold = false;
 
 	uart_state = UART_IRQ_UPDATE;
 
 	if (!uart_irq_is_pending(dev))
 		return;
 
-	if (uart_irq_tx_ready(dev)) {
-		data_transmitted = true;
+	if (uart_irq_tx_ready(dev) && atomic_get(&tx_busy)) {
 		uart_state = UART_TX_READY;
+		tx_ring_drain(dev);
 	}
 
 	while (uart_irq_rx_ready(dev)) {
 		uart_state = UART_RX_READY;
 
-		/* We allocate a new buffer everytime we don't have a tail
-		 * the buffer might be recycled or not from a previous run.
+		head = (uint32_t)atomic_get(&rx_head);
+		space = RX_RING_SIZE - (head - (uint32_t)atomic_get(&rx_tail));
+
+		/* The task is falling behind, leave the data in the driver until
+		 * it has made some room. The task will re-enable the interrupt.
 		 */
-		if (tail == 0) {
-			DBG("[New]\n");
-			data = fifo_get_isr_buffer();
-			buf = data->line;
+		if (space == 0) {
+			uart_state = UART_BUFFER_OVERFLOW;
+			rx_throttle(dev);
+			flush = true;
+			break;
 		}
 
-		/* Read only until the end of the buffer
-		 * before i was using a ring buffer but was making things really
-		 * complicated for process side.
-		 */
-		len = MAX_LINE_LEN - tail;
-		bytes_read = uart_fifo_read(dev_upload, buf, len);
+		/* Read straight into the ring, only until the end of the buffer */
+		offset = head & RX_RING_MASK;
+		len = RX_RING_SIZE - offset;
+		if (len > space)
+			len = space;
+
+		uart_state = UART_FIFO_READ;
+		bytes_read = uart_fifo_read(dev, &rx_ring[offset], len);
+		if (bytes_read == 0)
+			break;
+
 		bytes_received += bytes_read;
-		tail += bytes_read;
-
-		data->line[tail] = 0;
-		//DGB("[%s]\r\n", data->line);
-
-		/* We don't want to flush data too fast otherwise we would be allocating
-		 * but we want to flush as soon as we have processed the data on the task
-		 * so we don't queue too much and delay the system response.
-		 *
-		 * When the process has finished dealing with the data it signals this method
-		 * with a 'i am ready to continue' by changing uart_process_done.
-		 *
-		 * It is also imperative to flush when we reach the limit of the buffer.
-		 */
-		bool flush = false;
 
-		if (uart_process_done ||
-			tail == MAX_LINE_LEN ||
-			(!uart_irq_rx_ready(dev) && bytes_read > 4)) {
-			flush = true;
-			uart_process_done = false;
+		/* First byte held, start counting the hold time */
+		if (head == (uint32_t)atomic_get(&rx_flush)) {
+			rx_hold_cycle = sys_cycle_get_32();
+			rx_hold_tick = sys_tick_get_32();
+			hold = true;
 		}
 
-		/* Check for line ends, to flush the data. The decoder / shell will probably
-		 * sit for a bit in the data so it is better if we finish this buffer and send it.
+		/* Line ends and control characters mean somebody is waiting
+		 * for an answer, no point in holding the data back.
 		 */
-		uart_state = UART_FIFO_READ;
-		while (bytes_read-- > 0) {
-			byte = *buf++;
-			if (byte == '\r' || byte == '\n' ||
-				(byte >= CTRL_START && byte <= CTRL_END)) {
-				flush = true;
-				break;
-			}
-		}
+		if (policy->flush_on_ctrl &&
+			rx_has_ctrl(&rx_ring[offset], bytes_read))
+			flush = true;
 
+		/* Publish the data once it has been written */
+		atomic_set(&rx_head, head + bytes_read);
 		uart_state = UART_FIFO_READ_END;
 
-		/* Happy to flush the data into the queue for processing */
-		if (flush) {
-			data->line[tail] = 0;
-			uart_state = UART_FIFO_READ_FLUSH;
-			nano_isr_fifo_put(&data_queue, data);
-			data = NULL;
-			tail = 0;
+		len = RX_RING_SIZE - space + bytes_read;
+		if (len > rx_high_water)
+			rx_high_water = len;
+
+		/* Give the host time to react before the ring fills up */
+		if (len >= RX_HIGH_WATER) {
+			rx_throttle(dev);
+			flush = true;
+			break;
 		}
 	}
+
+	head = (uint32_t)atomic_get(&rx_head);
+	if (policy->max_hold_ms == 0 ||
+		head - (uint32_t)atomic_get(&rx_flush) >= policy->min_batch)
+		flush = true;
+
+	if (flush) {
+		uart_state = UART_FIFO_READ_FLUSH;
+		rx_flush_to(head);
+	}
+
+	/* Wake up the task only if it is waiting, otherwise it will pick up
+	 * the new data as soon as it finishes with the current span.
+	 * On a new hold we also wake it up so it can arm the hold timeout.
+	 */
+	if ((flush || hold) && atomic_cas(&rx_consumer_waiting, 1, 0))
+		nano_isr_sem_give(&rx_sem);
+
+	timing_stop(TIMING_ISR, start, head - head_start);
+}
+
+/*
+ * @brief Re-enables reception once the ring is below the low watermark
+ *
+ * The patched CDC ACM driver takes the packet it held back and raises the
+ * callback from uart_irq_rx_enable. The stock driver only does that when
+ * a new packet arrives, so if it still has data we drain it ourselves.
+ * Either way the callback runs here and never from inside uart_fifo_read.
+ *
+ * @param starved The process took nothing and waits for more data, like
+ * a binary frame that has to be whole. The ring would never drain.
+ */
+static void rx_resume(bool starved) {
+	unsigned int key;
+
+	if (!atomic_get(&rx_paused) || (rx_ring_used() > RX_LOW_WATER && !starved))
+		return;
+
+	if (!atomic_cas(&rx_paused, 1, 0))
+		return;
+
+	key = irq_lock();
+	rx_send_flow(ASCII_XON);
+	uart_irq_rx_enable(dev_upload);
+	if (!atomic_get(&rx_paused) && uart_irq_rx_ready(dev_upload))
+		interrupt_handler(dev_upload);
+	irq_unlock(key);
 }
 
 /*************************** ACM OUTPUT *******************************/
+
+static void out_flush(void);
+
+/*
+ * @brief Appends a character to the output line
+ */
+static void out_putc(char c) {
+	unsigned int key = irq_lock();
+	bool first = (out_len == 0);
+	uint32_t written;
+	bool full;
+
+	if (first)
+		out_tick = sys_tick_get_32();
+
+	/* Another writer filled the line and has not flushed it yet, move
+	 * what fits into the ring before the line overflows.
+	 */
+	if (out_len == OUT_LINE_SIZE && dev_upload != NULL) {
+		written = tx_ring_put(out_line, out_len);
+		out_len -= written;
+		memmove(out_line, out_line + written, out_len);
+	}
+
+	/* Still no room, the character is lost */
+	if (out_len == OUT_LINE_SIZE) {
+		tx_truncate_count++;
+		irq_unlock(key);
+		return;
+	}
+
+	out_line[out_len++] = c;
+	full = (c == '\n' || out_len == OUT_LINE_SIZE);
+	irq_unlock(key);
+
+	if (full) {
+		out_flush();
+		return;
+	}
+
+	/* Somebody else is printing while the uploader sleeps, wake it up
+	 * so it can take care of the idle timeout.
+	 */
+	if (first && atomic_cas(&rx_consumer_waiting, 1, 0))
+		nano_sem_give(&rx_sem);
+}
+
 /**
 * @brief Output one character to UART ACM
 *
@@ -286,36 +714,170 @@ static void interrupt_handler(struct device *dev) {
 */
 
 static int acm_out(int c) {
-	acm_writec((char)c);
+	out_putc((char)c);
 	return 1;
 }
 
 /*
- * @brief Writes data into the uart and flushes it.
+ * @brief Sleeps until the TX interrupt makes some progress
+ */
+static void tx_wait(void) {
+	uint32_t used = tx_ring_used();
+	unsigned int key;
+	bool sleep = false;
+
+	/* Only count ourselves when we are going to sleep, every count gets
+	 * a give from the interrupt and a stale one would make the next
+	 * wait return early and spin.
+	 */
+	key = irq_lock();
+	if (tx_ring_used() == used && atomic_get(&tx_busy)) {
+		atomic_inc(&tx_writers_waiting);
+		sleep = true;
+	}
+	irq_unlock(key);
+
+	if (sleep)
+		nano_sem_take(&tx_sem, TICKS_UNLIMITED);
+}
+
+/*
+ * @brief Copies as much as fits into the ring and starts the transfer
+ *
+ * @return Number of bytes queued
+ */
+static uint32_t tx_ring_put(const char *buf, uint32_t len) {
+	unsigned int key = irq_lock();
+	uint32_t head = (uint32_t)atomic_get(&tx_head);
+	uint32_t used = head - (uint32_t)atomic_get(&tx_tail);
+	uint32_t space = TX_RING_SIZE - used;
+	uint32_t offset = head & TX_RING_MASK;
+	uint32_t chunk;
+
+	if (len > space)
+		len = space;
+
+	chunk = TX_RING_SIZE - offset;
+	if (chunk > len)
+		chunk = len;
+
+	memcpy(&tx_ring[offset], buf, chunk);
+	memcpy(tx_ring, buf + chunk, len - chunk);
+	atomic_set(&tx_head, head + len);
+
+	used += len;
+	if (used > tx_high_water)
+		tx_high_water = used;
+
+	/* Nobody is sending, start the transfer ourselves. The interrupt
+	 * will carry on with the rest once this span has been sent.
+	 */
+	if (len > 0 && !atomic_get(&tx_busy)) {
+		atomic_set(&tx_busy, 1);
+		uart_irq_tx_enable(dev_upload);
+		tx_ring_drain(dev_upload);
+	}
+
+	irq_unlock(key);
+	return len;
+}
+
+/*
+ * @brief Moves the output line into the transmit ring
+ */
+static void out_flush(void) {
+	unsigned int key;
+	uint32_t written;
+
+	if (dev_upload == NULL || out_len == 0)
+		return;
+
+	out_flush_count++;
+
+	while (1) {
+		key = irq_lock();
+		written = tx_ring_put(out_line, out_len);
+		out_len -= written;
+		memmove(out_line, out_line + written, out_len);
+		irq_unlock(key);
+
+		if (out_len == 0)
+			return;
+
+		/* Part of the line is already out, we can only cut it short */
+		if (tx_policy != ACM_TX_BLOCK) {
+			key = irq_lock();
+			tx_truncate_count += out_len;
+			out_len = 0;
+			irq_unlock(key);
+			return;
+		}
+
+		tx_wait();
+	}
+}
+
+void acm_set_tx_policy(enum acm_tx_policy policy) {
+	tx_policy = policy;
+}
+
+/*
+ * @brief Queues data to be sent through the uart
+ *
+ * It never waits for the data to be sent. What happens when the ring is
+ * full depends on the policy set with acm_set_tx_policy.
  *
  * @param buf Buffer to write
  * @param len length of buffer
- *
- * @todo Really dislike this wait here from the example
- * will probably rewrite it later with a line queue
+ * @return Number of bytes queued
  */
 
-void acm_write(const char *buf, int len) {
-	if (len == 0)
-		return;
+int acm_write(const char *buf, int len) {
+	uint32_t queued = 0;
+	uint32_t written;
+
+	if (len <= 0 || dev_upload == NULL)
+		return 0;
 
-	struct device *dev = dev_upload;
-	uart_irq_tx_enable(dev);
+	/* Keep the order with what was printed before */
+	out_flush();
 
-	data_transmitted = false;
-	uart_fifo_fill(dev, buf, len);
-	while (data_transmitted == false)
-		;
-	uart_irq_tx_disable(dev);
+	/* Drop the whole message rather than sending half of it */
+	if (tx_policy == ACM_TX_DROP && TX_RING_SIZE - tx_ring_used() < (uint32_t)len) {
+		tx_drop_count++;
+		return 0;
+	}
+
+	while (queued < (uint32_t)len) {
+		written = tx_ring_put(buf + queued, len - queued);
+		queued += written;
+
+		if (queued == (uint32_t)len)
+			break;
+
+		if (tx_policy != ACM_TX_BLOCK) {
+			tx_truncate_count += len - queued;
+			break;
+		}
+
+		tx_wait();
+	}
+
+	return queued;
+}
+
+/*
+ * @brief Waits until everything written has been sent
+ */
+void acm_flush(void) {
+	out_flush();
+
+	while (tx_ring_used() > 0 && atomic_get(&tx_busy))
+		tx_wait();
 }
 
 void acm_writec(char byte) {
-	acm_write(&byte, 1);
+	out_putc(byte);
 }
 
 void acm_print(const char *buf) {
@@ -324,7 +886,7 @@ void acm_print(const char *buf) {
 
 void acm_println(const char *buf) {
 	acm_write(buf, strlen(buf));
-	acm_write("\r\n", 3);
+	acm_write("\r\n", 2);
 }
 
 /**
@@ -347,6 +909,27 @@ uint8_t uart_get_last_state() {
 	return uart_state;
 }
 
+static void flush_stats_print(struct uploader_flush_policy *policy) {
+	struct uploader_flush_stats *stats = &policy->stats;
+	uint32_t cycles_per_us = sys_clock_hw_cycles_per_sec / 1000000;
+	uint32_t per_kb = 0;
+	uint32_t avg = 0;
+
+	if (stats->bytes > 0)
+		per_kb = (stats->chunks * 1024) / stats->bytes;
+
+	if (stats->latency_count > 0)
+		avg = stats->latency_total / stats->latency_count;
+
+	if (cycles_per_us == 0)
+		cycles_per_us = 1;
+
+	printf("[Flush] %s%s Chunks %d Bytes %d Chunks/KB %d Latency avg %dus max %dus\n",
+		policy->name, (policy == rx_policy) ? "*" : "",
+		(int)stats->chunks, (int)stats->bytes, (int)per_kb,
+		(int)(avg / cycles_per_us), (int)(stats->latency_max / cycles_per_us));
+}
+
 void uart_print_status() {
 	printf("******* SYSTEM STATE ********\n");
 
@@ -354,17 +937,144 @@ void uart_print_status() {
 		uploader_config.print_state();
 
 	printf("[State] %d\n", (int)uart_get_last_state());
-	printf("[Mem] Fifo %d Max Fifo %d Alloc %d Free %d \n",
-		(int)fifo_size, (int)max_fifo_size, (int)alloc_count, (int)free_count);
-	printf("Max fifo %d bytes\n", (int)(max_fifo_size * sizeof(struct uart_uploader_input)));
+	printf("[Ring] Used %d/%d High %d Chunk %d\n",
+		(int)rx_ring_used(), RX_RING_SIZE, (int)rx_high_water,
+		(int)rx_chunk_size);
+	printf("[Flow] Throttled %d Now %d Watermarks %d/%d Xoff lost %d\n",
+		(int)rx_throttle_count, (int)atomic_get(&rx_paused),
+		RX_LOW_WATER, RX_HIGH_WATER, (int)rx_xoff_failed);
 	printf("[Data] Received %d Processed %d \n",
 		(int)bytes_received, (int)bytes_processed);
+	printf("[Tx] Used %d/%d High %d Dropped %d Truncated %d Lines %d\n",
+		(int)tx_ring_used(), TX_RING_SIZE, (int)tx_high_water,
+		(int)tx_drop_count, (int)tx_truncate_count, (int)out_flush_count);
+	printf("[Ack] %s Window %d Last %d Sent %d\n", ack_mode_names[ack_mode],
+		(int)ack_window, (int)ack_last, (int)ack_count);
+	code_memory_print_status();
+
+	flush_stats_print(&uploader_flush_interactive);
+	flush_stats_print(&uploader_flush_bulk);
+	timing_print();
+}
+
+static void flush_stats_dump(struct uploader_flush_policy *policy) {
+	struct uploader_flush_stats *stats = &policy->stats;
+	uint32_t cycles_per_us = sys_clock_hw_cycles_per_sec / 1000000;
+	uint32_t avg = 0;
+
+	if (stats->latency_count > 0)
+		avg = stats->latency_total / stats->latency_count;
+
+	if (cycles_per_us == 0)
+		cycles_per_us = 1;
+
+	printf("flush name=%s active=%d chunks=%u bytes=%u latency_count=%u "
+		"latency_avg_us=%u latency_max_us=%u\n",
+		policy->name, policy == rx_policy, (unsigned int)stats->chunks,
+		(unsigned int)stats->bytes, (unsigned int)stats->latency_count,
+		(unsigned int)(avg / cycles_per_us),
+		(unsigned int)(stats->latency_max / cycles_per_us));
+}
+
+void uart_dump_status() {
+	printf("[STATS BEGIN]\n");
+	printf("uploader state=%d received=%u processed=%u ring_used=%u "
+		"ring_high=%u throttled=%u xoff_lost=%u\n",
+		(int)uart_get_last_state(), (unsigned int)bytes_received,
+		(unsigned int)bytes_processed, (unsigned int)rx_ring_used(),
+		(unsigned int)rx_high_water, (unsigned int)rx_throttle_count,
+		(unsigned int)rx_xoff_failed);
+	printf("tx used=%u high=%u dropped=%u truncated=%u lines=%u\n",
+		(unsigned int)tx_ring_used(), (unsigned int)tx_high_water,
+		(unsigned int)tx_drop_count, (unsigned int)tx_truncate_count,
+		(unsigned int)out_flush_count);
+	printf("ack mode=%s window=%u last=%u sent=%u\n", ack_mode_names[ack_mode],
+		(unsigned int)ack_window, (unsigned int)ack_last,
+		(unsigned int)ack_count);
+	code_memory_dump_status();
+	flush_stats_dump(&uploader_flush_interactive);
+	flush_stats_dump(&uploader_flush_bulk);
+	timing_dump();
+	printf("[STATS END]\n");
+}
+
+/*
+ * @brief Ticks left until ms have passed since start, TICKS_NONE if they have
+ */
+static int32_t ticks_left(uint32_t start, uint32_t ms) {
+	uint32_t elapsed = sys_tick_get_32() - start;
+	uint32_t ticks = (ms * sys_clock_ticks_per_sec + 999) / 1000;
+
+	return (elapsed < ticks) ? (int32_t)(ticks - elapsed) : TICKS_NONE;
+}
+
+/*
+ * @brief Sleeps until the ISR hands over at least need bytes
+ *
+ * If data is being held by the flush policy we sleep at most until its
+ * hold time expires and then we flush it ourselves. The same goes for
+ * output left in the output line by other tasks.
+ */
+static void rx_wait(uint32_t need) {
+	struct uploader_flush_policy *policy = rx_policy;
+	uint32_t chunks = policy->stats.chunks;
+	int32_t timeout, out_timeout;
+	unsigned int key;
+	bool waited = false;
+
+	/* Whatever the process printed goes out before we go to sleep */
+	out_flush();
+
+	while (rx_ring_ready() < need) {
+		DBG("[Wait]\n");
+		/* Tell the ISR we want to be woken up before checking again,
+		 * so we cannot miss data arriving in between.
+		 */
+		atomic_set(&rx_consumer_waiting, 1);
+
+		timeout = TICKS_UNLIMITED;
+		if (atomic_get(&rx_head) != atomic_get(&rx_flush))
+			timeout = ticks_left(rx_hold_tick, policy->max_hold_ms);
+
+		if (out_len > 0) {
+			out_timeout = ticks_left(out_tick, OUT_IDLE_MS);
+			if (timeout == TICKS_UNLIMITED || out_timeout < timeout)
+				timeout = out_timeout;
+		}
+
+		if (rx_ring_ready() < need && timeout != TICKS_NONE) {
+			waited = true;
+			nano_task_sem_take(&rx_sem, timeout);
+		}
+
+		atomic_set(&rx_consumer_waiting, 0);
+
+		if (atomic_get(&rx_head) != atomic_get(&rx_flush) &&
+			ticks_left(rx_hold_tick, policy->max_hold_ms) == TICKS_NONE) {
+			uart_state = UART_TIMEOUT;
+			key = irq_lock();
+			rx_flush_to(atomic_get(&rx_head));
+			irq_unlock(key);
+		}
+
+		if (out_len > 0 && ticks_left(out_tick, OUT_IDLE_MS) == TICKS_NONE)
+			out_flush();
+	}
+
+	/* Only chunks that found us idle tell how long the data sat around */
+	if (waited && policy->stats.chunks != chunks) {
+		uint32_t latency = sys_cycle_get_32() - rx_chunk_cycle;
+
+		policy->stats.latency_count++;
+		policy->stats.latency_total += latency;
+		if (latency > policy->stats.latency_max)
+			policy->stats.latency_max = latency;
+	}
 }
 
 void uart_uploader_runner(int arg1, int arg2) {
-	static struct uart_uploader_input *data = NULL;
-	char *buf = NULL;
-	uint32_t len = 0;
+	struct uploader_span span;
+	uint32_t handed_back = 0;
 
 	DBG("[Listening]\n");
 	__stdout_hook_install(acm_out);
@@ -376,36 +1086,67 @@ void uart_uploader_runner(int arg1, int arg2) {
 			uploader_config.interface.init_cb();
 		}
 
-		while (!uploader_config.interface.is_done()) {
-			uart_state = UART_WAITING;
+		/* Release whatever the previous policy was holding */
+		if (uploader_config.interface.flush_policy != NULL)
+			rx_policy = uploader_config.interface.flush_policy;
+		else
+			rx_policy = &uploader_flush_interactive;
+
+		/* Spans of the previous process are all gone, it is safe to change
+		 * the size for the new one.
+		 */
+		rx_chunk_size = uploader_config.interface.chunk_size;
+		if (rx_chunk_size == 0)
+			rx_chunk_size = MAX_LINE_LEN;
+		else if (rx_chunk_size > MAX_CHUNK_SIZE)
+			rx_chunk_size = MAX_CHUNK_SIZE;
 
-			while (data == NULL) {
-				DBG("[Wait]\n");
-				data = nano_task_fifo_get(&data_queue, TICKS_UNLIMITED);
-				buf = data->line;
-				len = strlen(buf);
+		unsigned int key = irq_lock();
+		rx_flush_to(atomic_get(&rx_head));
+		irq_unlock(key);
 
-				DBG("[Data]\n");
-				DBG("%s\n", buf);
-			}
+		handed_back = 0;
+		ack_last = 0;
 
-			uint32_t processed = uploader_config.interface.process_cb(buf, len);
+		while (!uploader_config.interface.is_done()) {
+			uart_state = UART_WAITING;
+
+			/* Nothing was taken from the last span, wait until there
+			 * is something new to offer.
+			 */
+			uint32_t start = timing_start();
+			rx_wait(handed_back + 1);
+			rx_span_get(&span, handed_back);
+			timing_stop(TIMING_WAIT, start, span.len);
+
+			DBG("[Data] %d\n", (int)span.len);
+
+			uart_state = UART_FIFO_DATA_PROCESS;
+			start = timing_start();
+			uint32_t processed = uploader_config.interface.process_cb(&span);
+			if (processed > span.len)
+				processed = span.len;
+			timing_stop(TIMING_PROCESS, start, processed);
+
+			/* A full span cannot grow any further, it is consumed even if
+			 * the process did not want it or we would offer it forever.
+			 */
+			if (processed == 0 && span.len == rx_chunk_size)
+				processed = span.len;
 
 			bytes_processed += processed;
 
-			if (uploader_config.interface.is_done()) {
-				len -= processed;
-				memcpy(buf, buf + processed, len);
-				buf[len] = '\0';
-				printf("New buf [%s]\n", buf);
-			} else {
-				uart_process_done = true;
-				DBG("[Recycle]\n");
-				fifo_recycle_buffer(data);
-				data = NULL;
-			}
+			/* Whatever was not processed stays in the ring, for the same
+			 * process or for the next one if this one has finished.
+			 */
+			rx_ring_consume(processed);
+			handed_back = (processed == 0) ? span.len : 0;
+
+			rx_resume(handed_back > 0);
+			uploader_ack(false);
 		}
 
+		uploader_ack(true);
 		uart_state = UART_CLOSE;
 		if (uploader_config.interface.close_cb != NULL)
 			uploader_config.interface.close_cb();
@@ -438,8 +1179,8 @@ void acm() {
 		return;
 	}
 
-	nano_fifo_init(&data_queue);
-	nano_fifo_init(&avail_queue);
+	nano_sem_init(&rx_sem);
+	nano_sem_init(&tx_sem);
 
 #ifdef CONFIG_UART_LINE_CTRL
 	uint32_t dtr = 0;
@@ -470,7 +1211,7 @@ void acm() {
 	uart_irq_tx_disable(dev_upload);
 
 	uart_irq_callback_set(dev_upload, interrupt_handler);
-	acm_write(banner, sizeof(banner));
+	acm_write(banner, sizeof(banner) - 1);
 
 	/* Enable rx interrupts */
 	uart_irq_rx_enable(dev_upload);
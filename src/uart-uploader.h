@@ -80,16 +80,40 @@ typedef uint32_t(*process_init_callback_t)();
 */
 typedef void(*process_error_callback_t)(uint32_t error);
 
+/*
+ * @brief Span of received data lent to the process
+ *
+ * The data is not NUL terminated and can contain any byte. It belongs to
+ * the receive ring and is only valid during the process callback.
+ * The token is the position of the first byte in the receive stream, so
+ * consecutive spans are contiguous when token + len matches the next token.
+ */
+struct uploader_span {
+	const char *buf;
+	uint32_t len;
+	uint32_t token;
+};
+
 /**
-* Callback function to pass an error from the transmision
+* Callback function to pass the data received
+*
+* Returns the number of bytes consumed, whatever is not consumed is handed
+* back and will be offered again at the start of the next span. If nothing
+* is consumed the span is only offered again once more data has arrived,
+* unless the span already had the maximum size, then it is dropped.
 */
-typedef uint32_t(*process_data_callback_t)(const char *buf, uint32_t len);
+typedef uint32_t(*process_data_callback_t)(const struct uploader_span *span);
 
 /**
 * Callback to tell when the data transfered is finished or process completed
 */
 typedef bool(*process_is_done)();
 
+/**
+* Callback to report the records and bytes accepted since init, for acks
+*/
+typedef void(*process_progress_callback_t)(uint32_t *records, uint32_t *bytes);
+
 /**
  * Callback function to pass an error from the transmision
  */
@@ -114,6 +138,38 @@ enum process_status_code {
  */
 typedef void(*process_status_callback_t)(enum process_status_code status_code);
 
+/*
+ * @brief Counters to evaluate how well a flush policy behaves
+ */
+struct uploader_flush_stats {
+	uint32_t chunks;          /* Number of times data was handed over */
+	uint32_t bytes;           /* Bytes handed over in those chunks */
+	uint32_t latency_count;   /* Chunks that found the process waiting */
+	uint32_t latency_total;   /* Arrival to process time in cycles */
+	uint32_t latency_max;
+};
+
+/*
+ * @brief Decides when received data is handed over to the process
+ *
+ * Data is held in the receive ring until at least min_batch bytes have
+ * arrived, a control character is found (if flush_on_ctrl is set) or the
+ * data has been waiting for max_hold_ms.
+ */
+struct uploader_flush_policy {
+	const char *name;
+	uint32_t min_batch;
+	uint32_t max_hold_ms;
+	bool flush_on_ctrl;
+	struct uploader_flush_stats stats;
+};
+
+/* Typed shell, every key goes through straight away */
+extern struct uploader_flush_policy uploader_flush_interactive;
+
+/* Uploads, batch as much as possible */
+extern struct uploader_flush_policy uploader_flush_bulk;
+
 /*
  * @brief Interfaces for the different uploaders and process handlers
  */
@@ -123,8 +179,32 @@ struct uploader_interface_cfg_data {
 	process_data_callback_t process_cb;
 	process_error_callback_t error_cb;
 	process_is_done is_done;
+
+	/* How to batch the incoming data, interactive if NULL */
+	struct uploader_flush_policy *flush_policy;
+
+	/* Maximum span handed to process_cb, 0 for the default */
+	uint32_t chunk_size;
+
+	/* Progress for the ack window, NULL if the process cannot tell */
+	process_progress_callback_t progress_cb;
 };
 
+enum uploader_ack_mode {
+	UPLOADER_ACK_OFF,
+	UPLOADER_ACK_RECORDS,
+	UPLOADER_ACK_BYTES
+};
+
+/*
+ * @brief Makes the device acknowledge uploads as they go
+ *
+ * "[ACK] <count>" is sent with the records or bytes the process accepted
+ * so far, whenever window more were accepted since the last one, and once
+ * more when the process finishes. The host can keep that many in flight.
+ */
+void uploader_set_ack(enum uploader_ack_mode mode, uint32_t window);
+
 /*
 * @brief UART process data configuration
 *
@@ -149,10 +229,26 @@ void process_set_config(struct uploader_cfg_data *config);
 uint32_t uart_get_baudrate(void);
 uint8_t uart_get_last_state();
 void uart_print_status();
+
+/* Same counters as uart_print_status, key=value lines for host scripts */
+void uart_dump_status();
+
 void uart_clear();
 
+/*
+ * @brief What acm_write does when the transmit ring is full
+ */
+enum acm_tx_policy {
+	ACM_TX_BLOCK,      /* Wait until everything has been queued */
+	ACM_TX_DROP,       /* Discard the whole write */
+	ACM_TX_TRUNCATE    /* Queue what fits and discard the rest */
+};
+
+void acm_set_tx_policy(enum acm_tx_policy policy);
+void acm_flush(void);
+
 void acm_println(const char *buf);
-void acm_write(const char *buf, int len);
+int acm_write(const char *buf, int len);
 void acm_writec(char byte);
 void acm_print(const char *buf);
 void acm_printf(const char *format, ...);
@@ -0,0 +1,62 @@
+/* Copyright 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __UPLOADER_LOG_H__
+#define __UPLOADER_LOG_H__
+
+#include <misc/printk.h>
+
+/*
+ * Console logging for the uploader. Messages above
+ * CONFIG_UPLOADER_LOG_LEVEL are compiled out, arguments included, so
+ * nothing is left of them in the data path. Use the trace ring from
+ * uploader-trace.h for anything that happens per record or per write.
+ */
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERR  1
+#define LOG_LEVEL_WRN  2
+#define LOG_LEVEL_INF  3
+#define LOG_LEVEL_DBG  4
+
+#ifndef CONFIG_UPLOADER_LOG_LEVEL
+#define CONFIG_UPLOADER_LOG_LEVEL LOG_LEVEL_WRN
+#endif
+
+#if CONFIG_UPLOADER_LOG_LEVEL >= LOG_LEVEL_ERR
+#define LOG_ERR(...) printk(__VA_ARGS__)
+#else
+#define LOG_ERR(...) do { } while (0)
+#endif
+
+#if CONFIG_UPLOADER_LOG_LEVEL >= LOG_LEVEL_WRN
+#define LOG_WRN(...) printk(__VA_ARGS__)
+#else
+#define LOG_WRN(...) do { } while (0)
+#endif
+
+#if CONFIG_UPLOADER_LOG_LEVEL >= LOG_LEVEL_INF
+#define LOG_INF(...) printk(__VA_ARGS__)
+#else
+#define LOG_INF(...) do { } while (0)
+#endif
+
+#if CONFIG_UPLOADER_LOG_LEVEL >= LOG_LEVEL_DBG
+#define LOG_DBG(...) printk(__VA_ARGS__)
+#else
+#define LOG_DBG(...) do { } while (0)
+#endif
+
+#endif /* __UPLOADER_LOG_H__ */
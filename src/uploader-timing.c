@@ -0,0 +1,137 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+* @file
+* @brief Stage timing for the uploader
+*
+* Min, average and max cycles plus a histogram for every stage between
+* the USB interrupt and the file system.
+*/
+
+#include <nanokernel.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "uploader-timing.h"
+
+static const char *const stage_names[TIMING_STAGES] = {
+	"isr",
+	"wait",
+	"process",
+	"write"
+};
+
+static const char *const bucket_names[TIMING_BUCKETS] = {
+	"<4us", "<16us", "<64us", "<256us", "<1ms", "<4ms", "<16ms", ">16ms"
+};
+
+static struct timing_stats stages[TIMING_STAGES];
+
+static uint32_t cycles_per_us(void) {
+	uint32_t cycles = sys_clock_hw_cycles_per_sec / 1000000;
+
+	return cycles ? cycles : 1;
+}
+
+void timing_stop(enum timing_stage stage, uint32_t start, uint32_t bytes) {
+	struct timing_stats *stats = &stages[stage];
+	uint32_t cycles = sys_cycle_get_32() - start;
+	uint32_t us = cycles / cycles_per_us();
+	int bucket = 0;
+
+	while (us >= 4 && bucket < TIMING_BUCKETS - 1) {
+		us >>= 2;
+		bucket++;
+	}
+
+	if (stats->count == 0 || cycles < stats->min)
+		stats->min = cycles;
+	if (cycles > stats->max)
+		stats->max = cycles;
+
+	stats->count++;
+	stats->total += cycles;
+	stats->bytes += bytes;
+	stats->histogram[bucket]++;
+}
+
+void timing_reset(void) {
+	unsigned int key = irq_lock();
+
+	memset(stages, 0, sizeof(stages));
+	irq_unlock(key);
+}
+
+/* Bytes per second while the stage was running */
+static uint32_t timing_rate(struct timing_stats *stats) {
+	uint32_t total_us = (uint32_t)(stats->total / cycles_per_us());
+
+	if (total_us == 0)
+		return 0;
+	return (uint32_t)((uint64_t)stats->bytes * 1000000 / total_us);
+}
+
+static uint32_t timing_avg_us(struct timing_stats *stats) {
+	if (stats->count == 0)
+		return 0;
+	return (uint32_t)(stats->total / stats->count / cycles_per_us());
+}
+
+void timing_print(void) {
+	struct timing_stats *stats;
+	int t, b;
+
+	for (t = 0; t < TIMING_STAGES; t++) {
+		stats = &stages[t];
+		printf("[Stage] %s Count %d Min %d Avg %d Max %d us Bytes %d Rate %d KB/s\n",
+			stage_names[t], (int)stats->count,
+			(int)(stats->min / cycles_per_us()), (int)timing_avg_us(stats),
+			(int)(stats->max / cycles_per_us()), (int)stats->bytes,
+			(int)(timing_rate(stats) / 1024));
+
+		if (stats->count == 0)
+			continue;
+
+		printf("       ");
+		for (b = 0; b < TIMING_BUCKETS; b++)
+			printf(" %s %d", bucket_names[b], (int)stats->histogram[b]);
+		printf("\n");
+	}
+}
+
+void timing_dump(void) {
+	struct timing_stats *stats;
+	int t, b;
+
+	for (t = 0; t < TIMING_STAGES; t++) {
+		stats = &stages[t];
+		printf("stage name=%s count=%u min_us=%u avg_us=%u max_us=%u "
+			"total_us=%u bytes=%u hist=",
+			stage_names[t], (unsigned int)stats->count,
+			(unsigned int)(stats->min / cycles_per_us()),
+			(unsigned int)timing_avg_us(stats),
+			(unsigned int)(stats->max / cycles_per_us()),
+			(unsigned int)(stats->total / cycles_per_us()),
+			(unsigned int)stats->bytes);
+
+		for (b = 0; b < TIMING_BUCKETS; b++)
+			printf(b ? ",%u" : "%u", (unsigned int)stats->histogram[b]);
+		printf("\n");
+	}
+}
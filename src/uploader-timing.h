@@ -0,0 +1,63 @@
+/* Copyright 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __UPLOADER_TIMING_H__
+#define __UPLOADER_TIMING_H__
+
+#include <stdint.h>
+#include <nanokernel.h>
+
+/* Stages the uploaded data goes through, in order */
+enum timing_stage {
+	TIMING_ISR,      /* USB interrupt moving data into the ring */
+	TIMING_WAIT,     /* Uploader task waiting for the ring */
+	TIMING_PROCESS,  /* process_cb of the current uploader */
+	TIMING_WRITE,    /* fs_write underneath cswrite */
+	TIMING_STAGES
+};
+
+/* Histogram buckets, <4us and then every bucket is 4 times wider */
+#define TIMING_BUCKETS 8
+
+struct timing_stats {
+	uint32_t count;
+	uint32_t min;             /* Cycles */
+	uint32_t max;
+	uint64_t total;
+	uint32_t bytes;           /* Bytes that went through the stage */
+	uint32_t histogram[TIMING_BUCKETS];
+};
+
+static inline uint32_t timing_start(void) {
+	return sys_cycle_get_32();
+}
+
+/*
+ * @brief Accounts the time since start to a stage
+ *
+ * Every stage is only timed from one context, either the ISR or the
+ * uploader task, so the counters need no locking.
+ */
+void timing_stop(enum timing_stage stage, uint32_t start, uint32_t bytes);
+
+void timing_reset(void);
+
+/* Human readable, for acm status */
+void timing_print(void);
+
+/* One key=value line per stage, for scripts */
+void timing_dump(void);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+* Copyright (c) 2016 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+* @file
+* @brief Binary trace ring for the uploader
+*
+* Events are stored as a few raw words and only turned into text when
+* the ring is printed, so tracing costs nothing on the console while an
+* upload is running.
+*/
+
+#include <nanokernel.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "uploader-trace.h"
+
+#define TRACE_MASK (CONFIG_UPLOADER_TRACE_ENTRIES - 1)
+
+#if (CONFIG_UPLOADER_TRACE_ENTRIES & TRACE_MASK) != 0
+#error "CONFIG_UPLOADER_TRACE_ENTRIES must be a power of two"
+#endif
+
+static const char *const event_names[TRACE_EVENTS] = {
+	"open",
+	"close",
+	"write",
+	"read",
+	"seek",
+	"flush",
+	"checksum",
+	"erase"
+};
+
+static struct trace_entry trace_ring[CONFIG_UPLOADER_TRACE_ENTRIES];
+
+/* Events added since the last reset, the ring keeps the newest ones */
+static uint32_t trace_count;
+
+void trace_add(enum trace_event event, uint16_t arg, int32_t value) {
+	struct trace_entry *entry;
+	unsigned int key = irq_lock();
+
+	entry = &trace_ring[trace_count & TRACE_MASK];
+	trace_count++;
+	irq_unlock(key);
+
+	entry->cycles = sys_cycle_get_32();
+	entry->event = event;
+	entry->arg = arg;
+	entry->value = value;
+}
+
+void trace_reset(void) {
+	unsigned int key = irq_lock();
+
+	trace_count = 0;
+	irq_unlock(key);
+}
+
+void trace_print(void) {
+	struct trace_entry *entry;
+	uint32_t cycles_us = sys_clock_hw_cycles_per_sec / 1000000;
+	uint32_t count = trace_count;
+	uint32_t first = 0;
+	uint32_t base;
+	uint32_t t;
+
+	if (count > CONFIG_UPLOADER_TRACE_ENTRIES)
+		first = count - CONFIG_UPLOADER_TRACE_ENTRIES;
+
+	printf("[Trace] Events %u Lost %u\n", (unsigned int)count,
+		(unsigned int)first);
+
+	if (cycles_us == 0)
+		cycles_us = 1;
+
+	base = trace_ring[first & TRACE_MASK].cycles;
+	for (t = first; t < count; t++) {
+		entry = &trace_ring[t & TRACE_MASK];
+		printf("  %8u us %-8s %5u %d\n",
+			(unsigned int)((entry->cycles - base) / cycles_us),
+			(entry->event < TRACE_EVENTS) ? event_names[entry->event] : "?",
+			(unsigned int)entry->arg, (int)entry->value);
+	}
+}
@@ -0,0 +1,58 @@
+/* Copyright 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __UPLOADER_TRACE_H__
+#define __UPLOADER_TRACE_H__
+
+#include <stdint.h>
+
+/* Events kept in the trace ring, arg and value depend on the event */
+enum trace_event {
+	TRACE_OPEN,      /* arg: mode,         value: fs result */
+	TRACE_CLOSE,     /* arg: 0,            value: fs result */
+	TRACE_WRITE,     /* arg: bytes asked,  value: bytes written or error */
+	TRACE_READ,      /* arg: bytes asked,  value: bytes read or error */
+	TRACE_SEEK,      /* arg: whence,       value: fs result */
+	TRACE_FLUSH,     /* arg: bytes,        value: address */
+	TRACE_CHECKSUM,  /* arg: record type,  value: address */
+	TRACE_ERASE,     /* arg: flash slot,   value: flash result */
+	TRACE_EVENTS
+};
+
+/* Power of two, the oldest events get overwritten */
+#ifndef CONFIG_UPLOADER_TRACE_ENTRIES
+#define CONFIG_UPLOADER_TRACE_ENTRIES 64
+#endif
+
+struct trace_entry {
+	uint32_t cycles;
+	uint16_t event;
+	uint16_t arg;
+	int32_t value;
+};
+
+/*
+ * @brief Adds an event to the ring
+ *
+ * Takes a few cycles and no console, safe from any context.
+ */
+void trace_add(enum trace_event event, uint16_t arg, int32_t value);
+
+void trace_reset(void);
+
+/* Decodes the ring to the console, oldest event first */
+void trace_print(void);
+
+#endif /* __UPLOADER_TRACE_H__ */